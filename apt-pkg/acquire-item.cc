@@ -49,8 +49,12 @@
 #include <string>
 #include <unordered_set>
 #include <vector>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include <apti18n.h>
 									/*}}}*/
@@ -114,6 +118,19 @@ static std::string GetExistingFilename(std::string const &File)		/*{{{*/
    return "";
 }
 									/*}}}*/
+static HashStringList GetHashesFromMessage(std::string const &Prefix, std::string const &Message) /*{{{*/
+{
+   HashStringList List;
+   for (char const *const *type = HashString::SupportedHashes(); *type != nullptr; ++type)
+   {
+      std::string const tagname = Prefix + *type + "-Hash";
+      std::string const hashsum = LookupTag(Message, tagname.c_str());
+      if (hashsum.empty() == false)
+	 List.push_back(HashString(*type, hashsum));
+   }
+   return List;
+}
+									/*}}}*/
 static std::string GetDiffIndexFileName(std::string const &Name)	/*{{{*/
 {
    return Name + ".diff/Index";
@@ -408,6 +425,54 @@ HashStringList pkgAcqFile::GetExpectedHashes() const
    return ExpectedHashes;
 }
 									/*}}}*/
+// GetSharedStoreFile - Where a file is kept in Dir::Cache::Shared	/*{{{*/
+/* The store is shared by all systems on a machine (chroots, containers, …)
+   which have it configured, so it is content-addressed: files are named
+   after their SHA256. A file taken from it is copied into partial/ first
+   and the hashes of that copy are verified as usual, which also means the
+   store can't introduce a file we wouldn't have accepted from a mirror. */
+static std::string GetSharedStoreFile(HashStringList const &Hashes)
+{
+   if (_config->Find("Dir::Cache::Shared").empty())
+      return "";
+   auto const * const SHA256 = Hashes.find("SHA256");
+   if (SHA256 == nullptr || SHA256->HashValue().empty())
+      return "";
+   return flCombine(_config->FindDir("Dir::Cache::Shared") + "SHA256", SHA256->HashValue());
+}
+									/*}}}*/
+// AddToSharedStore - Offer a verified file to the other systems	/*{{{*/
+/* Files appear in the store atomically via rename, so no locking is needed:
+   a reader sees either no file or a complete one, and writers racing each
+   other publish the same content. The other systems can write to the store,
+   so our files are never hardlinked into it: they are copied, sharing the
+   data with the original only if the filesystem supports it copy-on-write. */
+static void AddToSharedStore(std::string const &File, HashStringList const &Hashes)
+{
+   auto const Shared = GetSharedStoreFile(Hashes);
+   if (Shared.empty() || RealFileExists(Shared))
+      return;
+
+   _error->PushToStack();
+   std::string const Dir = flNotFile(Shared);
+   if (DirectoryExists(Dir) == false)
+      CreateDirectory(_config->FindDir("Dir::Cache::Shared"), Dir);
+   std::string const Temp = Shared + ".tmp." + std::to_string(getpid());
+   FileFd From, To;
+   bool Added = From.Open(File, FileFd::ReadOnly) && To.Open(Temp, FileFd::WriteOnly | FileFd::Create | FileFd::Exclusive, 0644);
+#ifdef FICLONE
+   if (Added && ioctl(To.Fd(), FICLONE, From.Fd()) != 0)
+#else
+   if (Added)
+#endif
+      Added = CopyFile(From, To);
+   Added = To.Close() && Added;
+   if (Added == false || rename(Temp.c_str(), Shared.c_str()) != 0)
+      unlink(Temp.c_str());
+   // failing to share a file is not a reason to fail its download
+   _error->RevertToStack();
+}
+									/*}}}*/
 // Acquire::Item::QueueURI and specialisations from child classes	/*{{{*/
 bool pkgAcquire::Item::QueueURI(pkgAcquire::ItemDesc &Item)
 {
@@ -489,6 +554,10 @@ bool pkgAcqTransactionItem::QueueURI(pkgAcquire::ItemDesc &Item)
       if (SameMirrorURI.empty() == false && PushByHashURI(SameMirrorURI) == false)
 	 SameMirrorURI.clear();
    }
+   // another system on this machine might have downloaded it already
+   if (FetchFromSharedStore())
+      if (auto const Shared = GetSharedStoreFile(GetExpectedHashes()); not Shared.empty() && RealFileExists(Shared))
+	 PushAlternativeURI("copy:" + pkgAcquire::URIEncode(Shared), {}, false);
    // the last URI added is the first one tried
    if (unlikely(PopAlternativeURI(Item.URI) == false))
       return false;
@@ -715,6 +784,22 @@ bool pkgAcqIndexMergeDiffs::AcquireByHash() const
    return false;
 }
 bool pkgAcqIndexDiffs::AcquireByHash() const
+{
+   return false;
+}
+									/*}}}*/
+// pkgAcqTransactionItem::FetchFromSharedStore and specialisations	/*{{{*/
+bool pkgAcqTransactionItem::FetchFromSharedStore() const
+{
+   return false;
+}
+// the decompression stage of indexes can deal with files outside of partial/
+bool pkgAcqIndex::FetchFromSharedStore() const
+{
+   return true;
+}
+// … but the diff index is parsed right where it was downloaded to
+bool pkgAcqDiffIndex::FetchFromSharedStore() const
 {
    return false;
 }
@@ -1419,6 +1504,141 @@ string pkgAcqMetaBase::Custom600Headers() const
    return Header;
 }
 									/*}}}*/
+// SignatureCacheFile - Remembering earlier signature verifications	/*{{{*/
+/* The cache is only written by us, never by the methods running as the
+   sandbox user, so an entry is as trustworthy as a verification the
+   method reports to us. Entries are identified by the verified files,
+   the keyrings and the policy they were verified with, so that changing
+   any of them invalidates them. Finding out when the signing keys expire
+   would need more than gpgv or sqv tell us, so entries instead expire
+   after the short Acquire::gpgv::Cache-Time, which bounds how long an
+   expired key can go unnoticed. The methods only allow caching
+   verifications which didn't produce any warnings. */
+static std::string SignatureCacheFile()
+{
+   if (not _config->Exists("Dir::Cache::Signatures") || _config->FindI("Acquire::gpgv::Cache-Time", 60 * 60) <= 0)
+      return "";
+   return _config->FindFile("Dir::Cache::Signatures");
+}
+									/*}}}*/
+// GetSignatureCacheKey - Identify a verification and what it depends on /*{{{*/
+static std::string GetSignatureCacheKey(std::string const &Access, std::string const &File, std::string const &Signature, std::string const &SignedBy)
+{
+   Hashes Key(Hashes::SHA256SUM);
+   auto const AddString = [&](std::string const &Str) { Key.Add(Str.c_str(), Str.length() + 1); };
+   auto const AddFileStat = [&](std::string const &F) {
+      AddString(F);
+      if (struct stat St; stat(F.c_str(), &St) == 0)
+	 AddString(std::to_string(St.st_ino) + ' ' + std::to_string(St.st_size) + ' ' +
+		   std::to_string(St.st_mtim.tv_sec) + '.' + std::to_string(St.st_mtim.tv_nsec));
+   };
+   AddString(Access);
+   AddString(SignedBy);
+   for (auto const &F : {File, Signature})
+   {
+      FileFd Fd;
+      if (not Fd.Open(F, FileFd::ReadOnly) || not Key.AddFD(Fd))
+	 return "";
+      AddString(std::to_string(Fd.Size()));
+      if (File == Signature)
+	 break;
+   }
+
+   _error->PushToStack();
+   auto Keyrings = GetListOfFilesInDir(_config->FindDir("Dir::Etc::TrustedParts"), std::vector<std::string>{"gpg", "asc"}, true);
+   _error->RevertToStack();
+   Keyrings.push_back(_config->FindFile("Dir::Etc::Trusted"));
+   for (auto &&K : VectorizeString(SignedBy, ','))
+      if (not K.empty() && K[0] == '/')
+	 Keyrings.push_back(std::move(K));
+   for (auto const &K : Keyrings)
+      AddFileStat(K);
+
+   // the policy the methods apply: accepted algorithms for gpgv and
+   // the crypto policy for sqv (see SQVMethod::SetPolicy)
+   std::ostringstream Policy;
+   for (auto const Tree : {"APT::Key", "APT::Hashes", "Acquire::gpgv::Options"})
+      _config->Dump(Policy, Tree, "%F %v\n", false);
+   AddString(Policy.str());
+   for (auto const Env : {"APT_SEQUOIA_CRYPTO_POLICY", "SEQUOIA_CRYPTO_POLICY"})
+      if (auto const Value = getenv(Env); Value != nullptr)
+	 AddString(std::string(Env) + '=' + Value);
+   for (auto const F : {"/etc/crypto-policies/back-ends/apt-sequoia.config",
+			"/var/lib/crypto-config/profiles/current/apt-sequoia.config",
+			"/etc/crypto-policies/back-ends/sequoia.config",
+			"/var/lib/crypto-config/profiles/current/sequoia.config",
+			"/usr/share/apt/default-sequoia.config"})
+      AddFileStat(F);
+   return Key.GetHashString(Hashes::SHA256SUM).HashValue();
+}
+									/*}}}*/
+// ReadSignatureCache - Entries of the cache which are still valid	/*{{{*/
+/* An entry is: key, time of verification, signers and the quoted output
+   of gpgv */
+static std::vector<std::array<std::string, 4>> ReadSignatureCache(std::string const &CacheFile)
+{
+   std::vector<std::array<std::string, 4>> Entries;
+   FileFd Fd;
+   _error->PushToStack();
+   if (RealFileExists(CacheFile) && Fd.Open(CacheFile, FileFd::ReadOnly))
+   {
+      time_t const Now = time(nullptr);
+      time_t const CacheTime = _config->FindI("Acquire::gpgv::Cache-Time", 60 * 60);
+      for (std::string Line; Fd.ReadLine(Line);)
+      {
+	 auto Fields = VectorizeString(Line, ' ');
+	 if (Fields.size() != 4)
+	    continue;
+	 time_t const Verified = strtoll(Fields[1].c_str(), nullptr, 10);
+	 if (Verified > Now || Verified + CacheTime <= Now)
+	    continue;
+	 Entries.push_back({std::move(Fields[0]), std::move(Fields[1]), std::move(Fields[2]), std::move(Fields[3])});
+      }
+   }
+   _error->RevertToStack();
+   return Entries;
+}
+									/*}}}*/
+// LookupSignatureCache - Signers and output of a still valid verification /*{{{*/
+static bool LookupSignatureCache(std::string const &Key, std::string &Signers, std::string &Output)
+{
+   auto const CacheFile = SignatureCacheFile();
+   if (Key.empty() || CacheFile.empty())
+      return false;
+   for (auto const &E : ReadSignatureCache(CacheFile))
+      if (E[0] == Key)
+      {
+	 Signers = E[2];
+	 Output = E[3] == "-" ? "" : E[3];
+	 return true;
+      }
+   return false;
+}
+									/*}}}*/
+// StoreSignatureCache - Remember a successful verification		/*{{{*/
+static void StoreSignatureCache(std::string const &Key, std::string const &Message)
+{
+   auto const CacheFile = SignatureCacheFile();
+   auto const Signers = LookupTag(Message, "Signed-By");
+   // the method tells us if the verification can be remembered
+   if (Key.empty() || Signers.empty() || CacheFile.empty() || not StringToBool(LookupTag(Message, "Signature-Cacheable"), false))
+      return;
+   auto const Output = LookupTag(Message, "GPGVOutput");
+   auto Entries = ReadSignatureCache(CacheFile);
+   Entries.erase(std::remove_if(Entries.begin(), Entries.end(), [&](auto const &E) { return E[0] == Key; }), Entries.end());
+   Entries.push_back({Key, std::to_string(time(nullptr)), SubstVar(Signers, "\n", ","), Output.empty() ? "-" : QuoteString(Output, "")});
+
+   std::string Data;
+   for (auto const &E : Entries)
+      Data.append(APT::String::Join(std::vector<std::string>(E.begin(), E.end()), " ")).append("\n");
+   // not being able to write the cache (e.g. as a user) just means no caching
+   _error->PushToStack();
+   FileFd Fd;
+   if (Fd.Open(CacheFile, FileFd::WriteAtomic, FileFd::None, 0644) && Fd.Write(Data.c_str(), Data.length()))
+      Fd.Close();
+   _error->RevertToStack();
+}
+									/*}}}*/
 // AcqMetaBase::QueueForSignatureVerify					/*{{{*/
 void pkgAcqMetaBase::QueueForSignatureVerify(pkgAcqTransactionItem * const I, std::string const &File, std::string const &Signature)
 {
@@ -1432,6 +1652,15 @@ void pkgAcqMetaBase::QueueForSignatureVerify(pkgAcqTransactionItem * const I, st
 #else
    I->Desc.URI = "gpgv:" + pkgAcquire::URIEncode(Signature);
 #endif
+   if (SignatureCacheFile().empty() == false)
+   {
+      SignatureCacheKey = GetSignatureCacheKey(I->Desc.URI.substr(0, I->Desc.URI.find(':')), File, Signature, TransactionManager->MetaIndexParser->GetSignedBy());
+      CachedSigners.clear();
+      CachedOutput.clear();
+      LookupSignatureCache(SignatureCacheKey, CachedSigners, CachedOutput);
+      if (_config->FindB("Debug::pkgAcquire::Auth", false))
+	 std::clog << "Signature of " << File << " is " << (CachedSigners.empty() ? "not " : "") << "in the cache as " << SignatureCacheKey << std::endl;
+   }
    I->DestFile = File;
    QueueURI(I->Desc);
    I->SetActiveSubprocess("gpgv");
@@ -1518,6 +1747,8 @@ bool pkgAcqMetaBase::CheckAuthDone(string const &Message, pkgAcquire::MethodConf
    // to verify the indexes we are about to download
    if (_config->FindB("Debug::pkgAcquire::Auth", false))
       std::cerr << "Signature verification succeeded: " << DestFile << std::endl;
+   if (CachedSigners.empty())
+      StoreSignatureCache(SignatureCacheKey, Message);
 
    if (TransactionManager->IMSHit == false)
    {
@@ -1951,6 +2182,12 @@ string pkgAcqMetaClearSig::Custom600Headers() const
    std::string const key = TransactionManager->MetaIndexParser->GetSignedBy();
    if (key.empty() == false)
       Header += "\nSigned-By: " + QuoteString(key, "");
+   if (AuthPass && CachedSigners.empty() == false)
+   {
+      Header += "\nVerified-Signed-By: " + CachedSigners;
+      if (CachedOutput.empty() == false)
+	 Header += "\nVerified-GPGVOutput: " + CachedOutput;
+   }
 
    return Header;
 }
@@ -2211,6 +2448,12 @@ std::string pkgAcqMetaSig::Custom600Headers() const
    std::string const key = TransactionManager->MetaIndexParser->GetSignedBy();
    if (key.empty() == false)
       Header += "\nSigned-By: " + QuoteString(key, "");
+   if (MetaIndex->AuthPass && MetaIndex->CachedSigners.empty() == false)
+   {
+      Header += "\nVerified-Signed-By: " + MetaIndex->CachedSigners;
+      if (MetaIndex->CachedOutput.empty() == false)
+	 Header += "\nVerified-GPGVOutput: " + MetaIndex->CachedOutput;
+   }
    return Header;
 }
 									/*}}}*/
@@ -2661,37 +2904,73 @@ bool pkgAcqDiffIndex::ParseDiffIndex(string const &IndexDiffFile)	/*{{{*/
    }
 
    // calculate the size of all patches we have to get
+   unsigned long long downloadSize = 0;
+   if (pdiff_merge)
+      downloadSize = std::accumulate(available_patches.begin(), available_patches.end(), 0llu,
+				     [](unsigned long long const T, DiffInfo const &I) {
+					return T + I.download_hashes.FileSize();
+				     });
+   // if server-side merging, assume we will need only the first patch
+   else if (not available_patches.empty())
+      downloadSize = available_patches.front().download_hashes.FileSize();
+   unsigned long long downloadSizeIdx = 0;
+   if (downloadSize != 0)
+   {
+      auto const types = VectorizeString(Target.Option(IndexTarget::COMPRESSIONTYPES), ' ');
+      for (auto const &t : types)
+      {
+	 std::string MetaKey = Target.MetaKey;
+	 if (t != "uncompressed")
+	    MetaKey += '.' + t;
+	 HashStringList const hsl = GetExpectedHashesFor(MetaKey);
+	 if (unlikely(hsl.usable() == false))
+	    continue;
+	 downloadSizeIdx = hsl.FileSize();
+	 break;
+      }
+   }
+
    unsigned short const sizeLimitPercent = _config->FindI("Acquire::PDiffs::SizeLimit", 100);
-   if (sizeLimitPercent > 0)
-   {
-      unsigned long long downloadSize = 0;
-      if (pdiff_merge)
-	 downloadSize = std::accumulate(available_patches.begin(), available_patches.end(), 0llu,
-					[](unsigned long long const T, DiffInfo const &I) {
-					   return T + I.download_hashes.FileSize();
-					});
-      // if server-side merging, assume we will need only the first patch
-      else if (not available_patches.empty())
-	 downloadSize = available_patches.front().download_hashes.FileSize();
-      if (downloadSize != 0)
+   if (sizeLimitPercent > 0 && downloadSize != 0)
+   {
+      unsigned long long const sizeLimit = downloadSizeIdx * sizeLimitPercent;
+      if ((sizeLimit/100) < downloadSize)
       {
-	 unsigned long long downloadSizeIdx = 0;
-	 auto const types = VectorizeString(Target.Option(IndexTarget::COMPRESSIONTYPES), ' ');
-	 for (auto const &t : types)
-	 {
-	    std::string MetaKey = Target.MetaKey;
-	    if (t != "uncompressed")
-	       MetaKey += '.' + t;
-	    HashStringList const hsl = GetExpectedHashesFor(MetaKey);
-	    if (unlikely(hsl.usable() == false))
-	       continue;
-	    downloadSizeIdx = hsl.FileSize();
-	    break;
-	 }
-	 unsigned long long const sizeLimit = downloadSizeIdx * sizeLimitPercent;
-	 if ((sizeLimit/100) < downloadSize)
+	 strprintf(ErrorText, "Need %llu compressed bytes, but limit is %llu and original is %llu", downloadSize, (sizeLimit/100), downloadSizeIdx);
+	 return false;
+      }
+   }
+
+   /* the size alone ignores that each patch is a request of its own and
+      that patching isn't free either, so if we know how the mirror performs
+      in this run we can estimate which way is faster */
+   if (_config->FindB("Acquire::PDiffs::CostModel", false) && downloadSize != 0 && downloadSizeIdx != 0)
+   {
+      pkgAcquire::HostStats Stats;
+      if (GetOwner()->GetHostStats(pkgAcquire::HostStatsKey(Target.URI), Stats) == false || Stats.Bandwidth == 0)
+      {
+	 if (Debug)
+	    std::clog << "pkgAcqDiffIndex: " << IndexDiffFile << ": No measurements for the mirror, can't estimate costs" << std::endl;
+      }
+      else
+      {
+	 // rred reads the complete file once and every line of the patches
+	 double const rredSpeed = std::max(1, _config->FindI("Acquire::PDiffs::RredSpeed", 100 * 1024)) * 1024.0;
+	 unsigned long long const patchedSize = std::accumulate(available_patches.begin(), available_patches.end(), LocalHashes.FileSize(),
+								[](unsigned long long const T, DiffInfo const &I) {
+								   return T + I.patch_hashes.FileSize();
+								});
+	 double const latency = std::chrono::duration<double>(Stats.Latency).count();
+	 double const requests = pdiff_merge ? available_patches.size() : 1;
+	 double const costPatches = requests * latency + downloadSize / static_cast<double>(Stats.Bandwidth) + patchedSize / rredSpeed;
+	 double const costIndex = latency + downloadSizeIdx / static_cast<double>(Stats.Bandwidth);
+	 if (Debug)
+	    std::clog << "pkgAcqDiffIndex: " << IndexDiffFile << ": Mirror has a latency of " << latency << "s and "
+		      << Stats.Bandwidth << " bytes/s, so " << requests << " patches are estimated at " << costPatches
+		      << "s and the complete file at " << costIndex << "s" << std::endl;
+	 if (costIndex < costPatches)
 	 {
-	    strprintf(ErrorText, "Need %llu compressed bytes, but limit is %llu and original is %llu", downloadSize, (sizeLimit/100), downloadSizeIdx);
+	    strprintf(ErrorText, "Patches are estimated to take %.2fs, but the complete file only %.2fs", costPatches, costIndex);
 	    return false;
 	 }
       }
@@ -3018,7 +3297,7 @@ pkgAcqIndexMergeDiffs::pkgAcqIndexMergeDiffs(pkgAcquire *const Owner,
 					     DiffInfo const &patch,
 					     std::vector<pkgAcqIndexMergeDiffs *> const *const allPatches)
     : pkgAcqBaseIndex(Owner, TransactionManager, Target),
-      patch(patch), allPatches(allPatches), State(StateFetchDiff)
+      patch(patch), allPatches(allPatches), PatchForRred(false), State(StateFetchDiff)
 {
    Debug = _config->FindB("Debug::pkgAcquire::Diffs",false);
 
@@ -3094,28 +3373,38 @@ void pkgAcqIndexMergeDiffs::Done(string const &Message, HashStringList const &Ha
    switch (State)
    {
       case StateFetchDiff:
-	 // check if this is the last completed diff
+	 PatchFile = DestFile;
+	 PatchHashes = patch.patch_hashes;
 	 State = StateDoneDiff;
-	 for (std::vector<pkgAcqIndexMergeDiffs *>::const_iterator I = allPatches->begin();
-	       I != allPatches->end(); ++I)
-	    if ((*I)->State != StateDoneDiff)
-	    {
-	       if(Debug)
-		  std::clog << "Not the last done diff in the batch: " << Desc.URI << std::endl;
-	       return;
-	    }
-	 for (auto * diff : *allPatches)
-	    Rename(diff->DestFile, GetMergeDiffsPatchFileName(UnpatchedFile, diff->patch.file));
-	 // this is the last completed diff, so we are ready to apply now
-	 DestFile = GetKeepCompressedFileName(UncompressedUnpatchedFile + "-patched", Target);
+	 QueueRred(UnpatchedFile);
+	 return;
+      case StateMergeDiff:
+      {
+	 // the merged patch replaces all the patches it was made from
+	 pkgAcqIndexMergeDiffs * last = nullptr;
+	 for (auto * const diff : *allPatches)
+	 {
+	    if (diff->PatchForRred == false || diff->PatchFile.empty())
+	       continue;
+	    RemoveFile("pkgAcqIndexMergeDiffs::Done", diff->PatchFile);
+	    diff->PatchFile.clear();
+	    last = diff;
+	 }
+	 if (unlikely(last == nullptr))
+	 {
+	    _error->Fatal("Merged patch %s has no patches to replace", DestFile.c_str());
+	    State = StateErrorDiff;
+	    return;
+	 }
+	 last->PatchFile = GetMergeDiffsPatchFileName(UnpatchedFile, last->patch.file);
+	 last->PatchHashes = Hashes;
+	 Rename(DestFile, last->PatchFile);
 	 if(Debug)
-	    std::clog << "Sending to rred method: " << UnpatchedFile << std::endl;
-	 State = StateApplyDiff;
-	 Local = true;
-	 Desc.URI = "rred:" + pkgAcquire::URIEncode(UnpatchedFile);
-	 QueueURI(Desc);
-	 SetActiveSubprocess("rred");
+	    std::clog << "Merged patches up to " << last->patch.file << " for " << UnpatchedFile << std::endl;
+	 State = StateDoneDiff;
+	 QueueRred(UnpatchedFile);
 	 return;
+      }
       case StateApplyDiff:
 	 // success in download & apply all diffs, finialize and clean up
 	 if(Debug)
@@ -3143,16 +3432,21 @@ void pkgAcqIndexMergeDiffs::Done(string const &Message, HashStringList const &Ha
 									/*}}}*/
 std::string pkgAcqIndexMergeDiffs::Custom600Headers() const		/*{{{*/
 {
-   if(State != StateApplyDiff)
+   if(State != StateApplyDiff && State != StateMergeDiff)
       return pkgAcqBaseIndex::Custom600Headers();
    std::ostringstream patchhashes;
    unsigned int seen_patches = 0;
-   for (auto && hs : (*allPatches)[0]->patch.result_hashes)
-      patchhashes <<  "\nStart-" << hs.HashType() << "-Hash: " << hs.HashValue();
+   if (State == StateMergeDiff)
+      patchhashes << "\nMerge-Patches: yes";
+   else
+      for (auto && hs : (*allPatches)[0]->patch.result_hashes)
+	 patchhashes <<  "\nStart-" << hs.HashType() << "-Hash: " << hs.HashValue();
    for (std::vector<pkgAcqIndexMergeDiffs *>::const_iterator I = allPatches->begin();
 	 I != allPatches->end(); ++I)
    {
-      HashStringList const ExpectedHashes = (*I)->patch.patch_hashes;
+      if ((*I)->PatchForRred == false || (*I)->PatchFile.empty())
+	 continue;
+      HashStringList const &ExpectedHashes = (*I)->PatchHashes;
       for (HashStringList::const_iterator hs = ExpectedHashes.begin(); hs != ExpectedHashes.end(); ++hs)
 	 patchhashes <<  "\nPatch-" << std::to_string(seen_patches) << "-" << hs->HashType() << "-Hash: " << hs->HashValue();
       ++seen_patches;
@@ -3161,6 +3455,60 @@ std::string pkgAcqIndexMergeDiffs::Custom600Headers() const		/*{{{*/
    return patchhashes.str();
 }
 									/*}}}*/
+void pkgAcqIndexMergeDiffs::QueueRred(std::string const &UnpatchedFile)	/*{{{*/
+{
+   // rred works on one set of patches per index at a time
+   if (std::any_of(allPatches->begin(), allPatches->end(), [](pkgAcqIndexMergeDiffs const * const P) {
+	  return P->State == StateMergeDiff || P->State == StateApplyDiff;
+       }))
+      return;
+
+   // patches can only be merged in order
+   auto const missing = std::find_if(allPatches->begin(), allPatches->end(),
+	 [](pkgAcqIndexMergeDiffs const * const P) { return P->State == StateFetchDiff; });
+   bool const lastPatch = missing == allPatches->end();
+   auto const patches = std::count_if(allPatches->begin(), missing,
+	 [](pkgAcqIndexMergeDiffs const * const P) { return P->PatchFile.empty() == false; });
+   if (lastPatch == false && patches < 2)
+   {
+      if(Debug)
+	 std::clog << "Not enough patches to merge yet: " << Desc.URI << std::endl;
+      return;
+   }
+
+   for (auto I = allPatches->begin(); I != missing; ++I)
+   {
+      auto * const diff = *I;
+      if (diff->PatchForRred || diff->PatchFile.empty())
+	 continue;
+      std::string const RredFile = GetMergeDiffsPatchFileName(UnpatchedFile, diff->patch.file);
+      Rename(diff->PatchFile, RredFile);
+      diff->PatchFile = RredFile;
+      diff->PatchForRred = true;
+   }
+
+   std::string const UncompressedUnpatchedFile = GetPartialFileNameFromURI(Target.URI);
+   if (lastPatch)
+   {
+      // this is the last completed diff, so we are ready to apply now
+      DestFile = GetKeepCompressedFileName(UncompressedUnpatchedFile + "-patched", Target);
+      if(Debug)
+	 std::clog << "Sending to rred method: " << UnpatchedFile << std::endl;
+      State = StateApplyDiff;
+   }
+   else
+   {
+      DestFile = UncompressedUnpatchedFile + "-merged.gz";
+      if(Debug)
+	 std::clog << "Sending to rred method for merging: " << UnpatchedFile << std::endl;
+      State = StateMergeDiff;
+   }
+   Local = true;
+   Desc.URI = "rred:" + pkgAcquire::URIEncode(UnpatchedFile);
+   QueueURI(Desc);
+   SetActiveSubprocess("rred");
+}
+									/*}}}*/
 pkgAcqIndexMergeDiffs::~pkgAcqIndexMergeDiffs() {}
 
 // AcqIndex::AcqIndex - Constructor					/*{{{*/
@@ -3241,6 +3589,10 @@ string pkgAcqIndex::Custom600Headers() const
    if(Target.IsOptional)
       msg += "\nFail-Ignore: true";
 
+   // spare us the decompression afterwards if the method can do it now
+   if (Stage == STAGE_DOWNLOAD && Target.KeepCompressed == false && CurrentCompressionExtension != "uncompressed")
+      msg += "\nDecompress-To: " + GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI), Target);
+
    return msg;
 }
 									/*}}}*/
@@ -3302,7 +3654,7 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
    Local = true;
    Complete = true;
 
-   std::string const AltFilename = LookupTag(Message,"Alt-Filename");
+   std::string AltFilename = LookupTag(Message,"Alt-Filename");
    std::string Filename = LookupTag(Message,"Filename");
 
    // we need to verify the file against the current Release file again
@@ -3319,8 +3671,31 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
       SetActiveSubprocess(::URI(Desc.URI).Access);
       return;
    }
+
+   // what we have downloaded ourselves is verified and can be shared
+   if (Filename == DestFile)
+      AddToSharedStore(Filename, GetExpectedHashes());
+
+   // methods like http:// can decompress the file while downloading it
+   std::string const Decompressed = GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI), Target);
+   if (Target.KeepCompressed == false && Filename == DestFile && AltFilename == Decompressed &&
+       CurrentCompressionExtension != "uncompressed")
+   {
+      Stage = STAGE_DECOMPRESS_AND_VERIFY;
+      HashStringList const AltHashes = GetHashesFromMessage("Alt-", Message);
+      if (AltHashes.usable() && AltHashes == GetExpectedHashes())
+      {
+	 EraseFileName = DestFile;
+	 DestFile = Decompressed;
+	 return StageDecompressDone();
+      }
+      // the download is fine, so decompress it ourselves instead
+      RemoveFile("pkgAcqIndex::StageDownloadDone", AltFilename);
+      AltFilename.clear();
+   }
+
    // methods like file:// give us an alternative (uncompressed) file
-   else if (Target.KeepCompressed == false && AltFilename.empty() == false)
+   if (Target.KeepCompressed == false && AltFilename.empty() == false)
    {
       Filename = AltFilename;
       EraseFileName.clear();
@@ -3567,6 +3942,13 @@ pkgAcqArchive::pkgAcqArchive(pkgAcquire *const Owner, pkgSourceList *const Sourc
       return;
    }
 
+   // another system on this machine might have downloaded it already
+   if (auto const Shared = GetSharedStoreFile(ExpectedHashes); not Shared.empty() && RealFileExists(Shared))
+   {
+      PushAlternativeURI(std::string(Desc.URI), {}, false);
+      Desc.URI = "copy:" + pkgAcquire::URIEncode(Shared);
+   }
+
    // Create the item
    Local = false;
    QueueURI(Desc);
@@ -3597,7 +3979,8 @@ void pkgAcqArchive::Done(string const &Message, HashStringList const &Hashes,
 
    // Done, move it into position
    string const FinalFile = GetFinalFilename();
-   Rename(DestFile,FinalFile);
+   if (Rename(DestFile,FinalFile))
+      AddToSharedStore(FinalFile, ExpectedHashes);
    StoreFilename = DestFile = FinalFile;
    Complete = true;
 }
@@ -395,6 +395,8 @@ class APT_HIDDEN pkgAcqTransactionItem: public pkgAcquire::Item		/*{{{*/
    [[nodiscard]] virtual std::string GetMetaKey() const;
    [[nodiscard]] bool HashesRequired() const override;
    [[nodiscard]] virtual bool AcquireByHash() const;
+   /** \brief If \b true, the file is taken from Dir::Cache::Shared if possible */
+   [[nodiscard]] virtual bool FetchFromSharedStore() const;
 
    pkgAcqTransactionItem(pkgAcquire * const Owner, pkgAcqMetaClearSig * const TransactionManager, IndexTarget const &Target) APT_NONNULL(2, 3);
    ~pkgAcqTransactionItem() override;
@@ -414,6 +416,13 @@ class APT_HIDDEN pkgAcqMetaBase : public pkgAcqTransactionItem		/*{{{*/
     */
    bool AuthPass;
 
+   /** \brief Identifies the signature verification in Dir::Cache::Signatures */
+   std::string SignatureCacheKey;
+   /** \brief Signers of a cached verification, passed on to the method */
+   std::string CachedSigners;
+   /** \brief Quoted output of gpgv for a cached verification */
+   std::string CachedOutput;
+
    /** \brief Called when a file is finished being retrieved.
     *
     *  If the file was not downloaded to DestFile, a copy process is
@@ -672,6 +681,7 @@ class APT_HIDDEN pkgAcqIndex : public pkgAcqBaseIndex
    [[nodiscard]] std::string Custom600Headers() const override;
    [[nodiscard]] std::string DescURI() const override { return Desc.URI; };
    [[nodiscard]] std::string GetMetaKey() const override;
+   [[nodiscard]] bool FetchFromSharedStore() const override;
 
    pkgAcqIndex(pkgAcquire * const Owner, pkgAcqMetaClearSig * const TransactionManager,
                IndexTarget const &Target, bool const Derived = false) APT_NONNULL(2, 3);
@@ -733,6 +743,7 @@ class APT_HIDDEN pkgAcqDiffIndex final : public pkgAcqIndex
 		     pkgAcquire::MethodConfig const *Cnf) override;
    [[nodiscard]] std::string DescURI() const override { return Target.URI + "Index"; };
    [[nodiscard]] std::string GetMetaKey() const override;
+   [[nodiscard]] bool FetchFromSharedStore() const override;
 
    /** \brief Parse the Index file for a set of Packages diffs.
     *
@@ -771,6 +782,9 @@ class APT_HIDDEN pkgAcqDiffIndex final : public pkgAcqIndex
  *  and call rred with all the patches downloaded once. Rred will then
  *  merge and apply them in one go, which should be a lot faster – but is
  *  incompatible with server-based merges of patches like reprepro can do.
+ *  While later patches are still downloading, the earlier ones are already
+ *  merged by rred as they arrive, so that only the application of the
+ *  merged patch remains to be done once the last patch is in.
  *
  *  \sa pkgAcqDiffIndex, pkgAcqIndex
  */
@@ -789,12 +803,26 @@ class APT_HIDDEN pkgAcqIndexMergeDiffs final : public pkgAcqBaseIndex
    /** \brief list of all download items for the patches */
    std::vector<pkgAcqIndexMergeDiffs*> const * const allPatches;
 
+   /** \brief where the downloaded patch is stored
+    *
+    *  Empty if it was merged into the patch of a later item. */
+   std::string PatchFile;
+
+   /** \brief hashes of the uncompressed patch in #PatchFile */
+   HashStringList PatchHashes;
+
+   /** \brief \b true if #PatchFile is where rred looks for patches */
+   bool PatchForRred;
+
    /** The current status of this patch. */
    enum DiffState
    {
       /** \brief The diff is currently being fetched. */
       StateFetchDiff,
 
+      /** \brief The diffs downloaded so far are currently being merged. */
+      StateMergeDiff,
+
       /** \brief The diff is currently being applied. */
       StateApplyDiff,
 
@@ -805,6 +833,12 @@ class APT_HIDDEN pkgAcqIndexMergeDiffs final : public pkgAcqBaseIndex
       StateErrorDiff
    } State;
 
+   /** \brief hand the patches downloaded so far to rred if it is idle
+    *
+    *  Once all patches are downloaded they are applied, otherwise the
+    *  available ones are merged into one if there are at least two. */
+   void QueueRred(std::string const &UnpatchedFile);
+
    public:
    /** \brief Called when the patch file failed to be downloaded.
     *
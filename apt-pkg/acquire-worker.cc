@@ -249,10 +249,13 @@ static void APT_NONNULL(3) ChangeSiteIsMirrorChange(std::string const &NewURI, p
 }
 bool pkgAcquire::Worker::RunMessages()
 {
-   while (MessageQueue.empty() == false)
+   // Erasing each message from the front as we go is quadratic in the number
+   // of queued messages, so drop all the processed ones in one go instead
+   std::vector<std::string>::size_type Processed = 0;
+   DEFER([&] { MessageQueue.erase(MessageQueue.begin(), MessageQueue.begin() + std::min(Processed, MessageQueue.size())); });
+   while (Processed < MessageQueue.size())
    {
-      string Message = MessageQueue.front();
-      MessageQueue.erase(MessageQueue.begin());
+      string Message = std::move(MessageQueue[Processed++]);
 
       if (Debug == true)
 	 clog << " <- " << Access << ':' << QuoteString(Message,"\n") << endl;
@@ -401,6 +404,7 @@ bool pkgAcquire::Worker::RunMessages()
 	    }
 
 	    CurrentItem = Itm;
+	    Itm->StartedAt = pkgAcquire::clock::now();
 	    Itm->CurrentSize = 0;
 	    Itm->TotalSize = strtoull(LookupTag(Message,"Size","0").c_str(), NULL, 10);
 	    Itm->ResumePoint = strtoull(LookupTag(Message,"Resume-Point","0").c_str(), NULL, 10);
@@ -477,6 +481,15 @@ bool pkgAcquire::Worker::RunMessages()
 		  Log->Fetched(ReceivedHashes.FileSize(),atoi(LookupTag(Message,"Resume-Point","0").c_str()));
 	    }
 
+	    // measure how the host performs for decisions like fetching pdiffs or not
+	    if (not Itm->Owner->Local && not AltFile)
+	    {
+	       unsigned long long Bytes = 0;
+	       if (not StringToBool(LookupTag(Message, "IMS-Hit"), false) && ReceivedHashes.FileSize() > Itm->ResumePoint)
+		  Bytes = ReceivedHashes.FileSize() - Itm->ResumePoint;
+	       Itm->Owner->GetOwner()->RecordTransfer(pkgAcquire::HostStatsKey(Itm->URI), this, Itm->SentAt, Itm->StartedAt, pkgAcquire::clock::now(), Bytes);
+	    }
+
 	    std::vector<Item*> const ItmOwners = Itm->Owners;
 	    for (auto const Owner : ItmOwners)
 	       Owner->ErrorText.clear();
@@ -935,6 +948,7 @@ bool pkgAcquire::Worker::QueueItem(pkgAcquire::Queue::QItem *Item)
       clog << " -> " << Access << ':' << QuoteString(Message,"\n") << endl;
    OutQueue += Message;
    OutReady = true;
+   Item->SentAt = pkgAcquire::clock::now();
 
    return true;
 }
@@ -28,12 +28,14 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <numeric>
 #include <regex>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include <cerrno>
@@ -68,16 +70,32 @@ std::string pkgAcquire::URIEncode(std::string const &part)		/*{{{*/
    return QuoteString(part, _config->Find("Acquire::URIEncode", "+~ ").c_str());
 }
 									/*}}}*/
+class pkgAcquire::Private
+{
+   public:
+   struct Transfers
+   {
+      unsigned long Requests = 0;
+      clock::duration Waited{};
+      unsigned long long Bytes = 0;
+      clock::duration Receiving{};
+   };
+   std::unordered_map<std::string, Transfers> Hosts;
+   // when each worker last finished a request, see Queue::ItemDone
+   std::unordered_map<Worker const *, clock::time_point> Answered;
+
+   void SaveHostStats(pkgAcquire const * const Owner) const;
+};
 // Acquire::pkgAcquire - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* We grab some runtime state from the configuration space */
-pkgAcquire::pkgAcquire() : LockFD(-1), d(NULL), Queues(0), Workers(0), Configs(0), Log(NULL), ToFetch(0),
+pkgAcquire::pkgAcquire() : LockFD(-1), d(new Private()), Queues(0), Workers(0), Configs(0), Log(NULL), ToFetch(0),
 			   Debug(_config->FindB("Debug::pkgAcquire",false)),
 			   Running(false)
 {
    Initialize();
 }
-pkgAcquire::pkgAcquire(pkgAcquireStatus *Progress) : LockFD(-1), d(NULL), Queues(0), Workers(0),
+pkgAcquire::pkgAcquire(pkgAcquireStatus *Progress) : LockFD(-1), d(new Private()), Queues(0), Workers(0),
 			   Configs(0), Log(NULL), ToFetch(0),
 			   Debug(_config->FindB("Debug::pkgAcquire",false)),
 			   Running(false)
@@ -200,6 +218,7 @@ pkgAcquire::~pkgAcquire()
       Configs = Configs->Next;
       delete Jnk;
    }   
+   delete d;
 }
 									/*}}}*/
 // Acquire::Shutdown - Clean out the acquire object			/*{{{*/
@@ -278,6 +297,131 @@ void pkgAcquire::Remove(Worker *Work)
       else
 	 I = &(*I)->NextAcquire;
    }
+   d->Answered.erase(Work);
+}
+									/*}}}*/
+// Acquire::RecordTransfer - Account a fetched file to its host	/*{{{*/
+// ---------------------------------------------------------------------
+/* Files which were not modified are accounted with no bytes transferred
+   as only their latency tells us something. A request pipelined behind
+   others on the same worker only starts to be answered once the one
+   before it is done, so it waits from whichever happened later. */
+void pkgAcquire::RecordTransfer(std::string const &Host, Worker const * const W, time_point Sent, time_point const Started, time_point const Done, unsigned long long const Bytes)
+{
+   if (auto const A = d->Answered.find(W); A != d->Answered.end() && Sent != time_point{})
+      Sent = std::max(Sent, A->second);
+   if (Host.empty() || Sent == time_point{} || Started < Sent || Done < Started)
+      return;
+   auto &T = d->Hosts[Host];
+   ++T.Requests;
+   T.Waited += Started - Sent;
+   if (Bytes != 0)
+   {
+      T.Bytes += Bytes;
+      T.Receiving += Done - Started;
+   }
+}
+									/*}}}*/
+// Acquire::HostStatsKey - Identify a host for the stats		/*{{{*/
+/* Mirrors on the same host can be different servers on different ports */
+std::string pkgAcquire::HostStatsKey(std::string const &URI)
+{
+   ::URI const U(URI);
+   if (U.Port == 0)
+      return U.Host;
+   return U.Host + ':' + std::to_string(U.Port);
+}
+									/*}}}*/
+// Acquire::GetHostStats - Measured performance of a host		/*{{{*/
+bool pkgAcquire::GetHostStats(std::string const &Host, HostStats &Stats) const
+{
+   auto const T = d->Hosts.find(Host);
+   if (T == d->Hosts.end() || T->second.Requests == 0)
+      return false;
+   using std::chrono::duration_cast;
+   Stats.Latency = duration_cast<std::chrono::microseconds>(T->second.Waited / T->second.Requests);
+   // everything arriving in the same instant only tells us that it is fast
+   auto const Receiving = duration_cast<std::chrono::microseconds>(T->second.Receiving).count();
+   Stats.Bandwidth = T->second.Bytes * 1000000 / std::max<decltype(Receiving)>(Receiving, 1);
+   return true;
+}
+									/*}}}*/
+// Acquire::Private::SaveHostStats - Remember how the hosts performed	/*{{{*/
+/* The mirror method prefers the mirrors which were fast in the past, so
+   we keep a moving average of what we measured for the hosts over the
+   runs. Hosts we haven't used for a month are forgotten. */
+void pkgAcquire::Private::SaveHostStats(pkgAcquire const * const Owner) const
+{
+   std::string const File = _config->FindFile("Dir::State::MirrorStats");
+   if (File.empty() || Hosts.empty() || access(flNotFile(File).c_str(), W_OK) != 0)
+      return;
+   // only users of the mirror method are interested in this
+   bool UsedMirror = false;
+   for (auto Conf = Owner->Configs; Conf != nullptr && UsedMirror == false; Conf = Conf->Next)
+      UsedMirror = Conf->Access.find("mirror") != std::string::npos;
+   if (UsedMirror == false)
+      return;
+
+   struct Entry
+   {
+      double Latency = 0;
+      double Bandwidth = 0;
+      time_t Seen = 0;
+   };
+   std::map<std::string, Entry> Stats;
+   time_t const Now = time(nullptr);
+   _error->PushToStack();
+   FileFd Fd;
+   if (RealFileExists(File) && Fd.Open(File, FileFd::ReadOnly))
+   {
+      std::string Line;
+      while (Fd.ReadLine(Line))
+      {
+	 std::istringstream Str(Line);
+	 std::string Host;
+	 Entry E;
+	 if (Str >> Host >> E.Latency >> E.Bandwidth >> E.Seen && E.Seen + 30 * 24 * 60 * 60 > Now)
+	    Stats[Host] = E;
+      }
+      Fd.Close();
+   }
+
+   double const Alpha = 0.3;
+   for (auto const &H : Hosts)
+   {
+      HostStats Measured;
+      if (Owner->GetHostStats(H.first, Measured) == false)
+	 continue;
+      auto const Known = Stats.find(H.first);
+      Entry &E = Stats[H.first];
+      if (Known == Stats.end())
+      {
+	 E.Latency = Measured.Latency.count();
+	 E.Bandwidth = Measured.Bandwidth;
+      }
+      else
+      {
+	 E.Latency += Alpha * (Measured.Latency.count() - E.Latency);
+	 if (Measured.Bandwidth != 0)
+	    E.Bandwidth += Alpha * (Measured.Bandwidth - E.Bandwidth);
+      }
+      if (E.Bandwidth == 0)
+	 E.Bandwidth = Measured.Bandwidth;
+      E.Seen = Now;
+   }
+
+   std::ostringstream Out;
+   Out << std::fixed << std::setprecision(0);
+   for (auto const &S : Stats)
+      Out << S.first << ' ' << S.second.Latency << ' ' << S.second.Bandwidth << ' ' << S.second.Seen << '\n';
+   std::string const Data = Out.str();
+   if (Fd.Open(File, FileFd::WriteAtomic, FileFd::None, 0644))
+   {
+      if (Fd.Write(Data.c_str(), Data.length()) == false)
+	 Fd.OpFail();
+      Fd.Close();
+   }
+   _error->RevertToStack();
 }
 									/*}}}*/
 // Acquire::Enqueue - Queue an URI for fetching				/*{{{*/
@@ -800,6 +944,8 @@ stop:
    for (ItemIterator I = Items.begin(); I != Items.end(); ++I)
       (*I)->Finished();
 
+   d->SaveHostStats(this);
+
    bool const newError = _error->PendingError();
    _error->MergeWithStack();
    if (newError)
@@ -1029,9 +1175,13 @@ bool pkgAcquire::Queue::Enqueue(ItemDesc &Item)
       }
       return true;
    };
+   // Optionally start the big downloads of a stage first, so that the
+   // connection is not busy with one of them alone at the end
+   bool const LargestFirst = _config->Find("Acquire::Queue-Order", "enqueue") == "largest-first";
    QItem **OptimalI = &Items;
    QItem **I = &Items;
-   auto insertLocation = std::make_tuple(Item.Owner->FetchAfter(), Item.Owner->Priority());
+   auto insertLocation = std::make_tuple(Item.Owner->FetchAfter(), Item.Owner->Priority(),
+					 LargestFirst ? Item.Owner->FileSize : 0ull);
    // move to the end of the queue and check for duplicates here
    for (; *I != 0; ) {
       if (Item.URI == (*I)->URI && MetaKeysMatch(Item, *I))
@@ -1045,7 +1195,8 @@ bool pkgAcquire::Queue::Enqueue(ItemDesc &Item)
       // Determine the optimal position to insert: before anything with a
       // higher priority.
       auto queueLocation = std::make_tuple((*I)->GetFetchAfter(),
-					   (*I)->GetPriority());
+					   (*I)->GetPriority(),
+					   LargestFirst ? (*I)->GetMaximumSize() : 0ull);
 
       I = &(*I)->Next;
       if (queueLocation >= insertLocation)
@@ -1167,7 +1318,7 @@ pkgAcquire::Queue::QItem *pkgAcquire::Queue::FindItem(string URI,pkgAcquire::Wor
    if (Owner->Config->GetSendURIEncoded())
    {
       for (QItem *I = Items; I != nullptr; I = I->Next)
-	 if (I->URI == URI && I->Worker == Owner)
+	 if (I->Worker == Owner && I->URI == URI)
 	    return I;
    }
    else
@@ -1192,6 +1343,9 @@ pkgAcquire::Queue::QItem *pkgAcquire::Queue::FindItem(string URI,pkgAcquire::Wor
    main queue too.*/
 bool pkgAcquire::Queue::ItemDone(QItem *Itm)
 {
+   // requests pipelined behind this one only start to be answered now
+   Owner->d->Answered[Itm->Worker] = clock::now();
+
    PipeDepth--;
    for (QItem::owner_iterator O = Itm->Owners.begin(); O != Itm->Owners.end(); ++O)
    {
@@ -99,8 +99,8 @@ class APT_PUBLIC pkgAcquire
    using time_point = std::chrono::time_point<clock>;
    /** \brief FD of the Lock file we acquire in Setup (if any) */
    int LockFD;
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   class Private;
+   Private * const d;
 
    public:
    
@@ -302,6 +302,24 @@ class APT_PUBLIC pkgAcquire
     */
    Worker *WorkerStep(Worker *I) APT_PURE;
 
+   /** \brief Transfer performance of a host as measured in this run */
+   struct HostStats
+   {
+      /** \brief average time from requesting a file until it starts to arrive */
+      std::chrono::microseconds Latency{0};
+      /** \brief bytes per second over all files received so far */
+      unsigned long long Bandwidth = 0;
+   };
+   /** \brief Get the transfer performance of a host
+    *
+    *  \return \b false if no file was fetched from the host so far.
+    */
+   APT_HIDDEN bool GetHostStats(std::string const &Host, HostStats &Stats) const;
+   /** \brief The host (and port, if given) of an URI the stats are kept for */
+   APT_HIDDEN static std::string HostStatsKey(std::string const &URI);
+   /** \brief Record a file fetched from a host for GetHostStats */
+   APT_HIDDEN void RecordTransfer(std::string const &Host, Worker const *W, time_point Sent, time_point Started, time_point Done, unsigned long long Bytes);
+
    /** \brief Get the head of the list of items. */
    inline ItemIterator ItemsBegin() {return Items.begin();};
    inline ItemCIterator ItemsBegin() const {return Items.begin();};
@@ -443,6 +461,11 @@ class APT_PUBLIC pkgAcquire::Queue
        */
       unsigned long long ResumePoint = 0;
 
+      /** \brief When the request was sent to the worker */
+      time_point SentAt{};
+      /** \brief When the method started to receive the file */
+      time_point StartedAt{};
+
       typedef std::vector<Item*>::const_iterator owner_iterator;
 
       /** \brief Assign the ItemDesc portion of this QItem from
@@ -560,25 +560,31 @@ void pkgProblemResolver::MakeScores()
    /* Now we cause 1 level of dependency inheritance, that is we add the 
       score of the packages that depend on the target Package. This 
       fortifies high scoring packages */
+   pkgCache &PkgCache = Cache.GetCache();
+   auto const Inherit = [&](pkgCache::PkgIterator const &I, pkgCache::DepIterator const &D) {
+      // Only do it for the install version
+      if ((pkgCache::Version const *)D.ParentVer() != Cache[D.ParentPkg()].InstallVer ||
+	  (D->Type != pkgCache::Dep::Depends &&
+	   D->Type != pkgCache::Dep::PreDepends &&
+	   D->Type != pkgCache::Dep::Recommends))
+	 return;
+
+      // Do not propagate negative scores otherwise
+      // an extra (-2) package might score better than an optional (-1)
+      if (OldScores[D.ParentPkg()->ID] > 0)
+	 Scores[I->ID] += OldScores[D.ParentPkg()->ID];
+   };
    for (pkgCache::PkgIterator I = Cache.PkgBegin(); I.end() == false; ++I)
    {
       if (Cache[I].InstallVer == 0)
 	 continue;
-      
-      for (pkgCache::DepIterator D = I.RevDependsList(); D.end() == false; ++D)
-      {
-	 // Only do it for the install version
-	 if ((pkgCache::Version *)D.ParentVer() != Cache[D.ParentPkg()].InstallVer ||
-	     (D->Type != pkgCache::Dep::Depends && 
-	      D->Type != pkgCache::Dep::PreDepends &&
-	      D->Type != pkgCache::Dep::Recommends))
-	    continue;	 
-	 
-	 // Do not propagate negative scores otherwise
-	 // an extra (-2) package might score better than an optional (-1)
-	 if (OldScores[D.ParentPkg()->ID] > 0)
-	     Scores[I->ID] += OldScores[D.ParentPkg()->ID];
-      }      
+
+      if (PkgCache.HasReverseIndex())
+	 for (auto const Dep : PkgCache.RevDepends(I))
+	    Inherit(I, pkgCache::DepIterator(PkgCache, PkgCache.DepP + Dep, PkgCache.PkgP));
+      else
+	 for (pkgCache::DepIterator D = I.RevDependsList(); D.end() == false; ++D)
+	    Inherit(I, D);
    }
 
    /* Now we propagate along provides. This makes the packages that
@@ -590,16 +596,21 @@ void pkgProblemResolver::MakeScores()
 	 continue;
 
       std::vector<map_id_t> providers;
-      for (auto Prv = I.ProvidesList(); not Prv.end(); ++Prv)
-      {
+      auto const AddProvider = [&](pkgCache::PrvIterator const &Prv) {
 	 if (Prv.IsMultiArchImplicit())
-	    continue;
+	    return;
 	 auto const PV = Prv.OwnerVer();
 	 auto const PP = PV.ParentPkg();
 	 if (PV != Cache[PP].InstVerIter(Cache))
-	    continue;
+	    return;
 	 providers.push_back(PP->ID);
-      }
+      };
+      if (PkgCache.HasReverseIndex())
+	 for (auto const Prv : PkgCache.RevProvides(I))
+	    AddProvider(pkgCache::PrvIterator(PkgCache, PkgCache.ProvideP + Prv, PkgCache.PkgP));
+      else
+	 for (auto Prv = I.ProvidesList(); not Prv.end(); ++Prv)
+	    AddProvider(Prv);
       std::sort(providers.begin(), providers.end());
       providers.erase(std::unique(providers.begin(), providers.end()), providers.end());
       for (auto const prv : providers)
@@ -1195,7 +1206,7 @@ bool pkgProblemResolver::ResolveInternal(bool const BrokenFix)
 	    std::clog << "Resolve installed new pkg: " << I.FullName(false) 
 		      << " (now marking it as auto)" << std::endl;
 	 }
-	 Cache[I].Flags |= pkgCache::Flag::Auto;
+	 Cache.MarkAuto(I, true);
       }
    }
 
@@ -99,8 +99,8 @@ bool pkgCacheFile::BuildCaches(OpProgress *Progress, bool WithLock)
       Map.reset(new MMap(file, MMap::Public|MMap::ReadOnly));
       if (unlikely(Map->validData() == false))
 	 return false;
-      Cache.reset(new pkgCache(Map.get()));
-      if (_error->PendingError() == true)
+      Cache.reset(new pkgCache(Map.get(), false));
+      if (Cache->ReMap(true, &file) == false || _error->PendingError() == true)
 	 return false;
 
       this->Cache = Cache.release();
@@ -956,7 +956,7 @@ bool ReadMessages(int Fd, vector<string> &List)
 	    if (APT::String::Endswith(PartialMessage, "\n") || APT::String::Endswith(PartialMessage, "\r\n\r"))
 	    {
 	       PartialMessage.erase(PartialMessage.find_last_not_of("\r\n") + 1);
-	       List.push_back(PartialMessage);
+	       List.push_back(std::move(PartialMessage));
 	       PartialMessage.clear();
 	       while (NL < End && (*NL == '\n' || *NL == '\r')) ++NL;
 	       Start = NL;
@@ -979,7 +979,7 @@ bool ReadMessages(int Fd, vector<string> &List)
 	 {
 	    PartialMessage.append(Start, NL2 - Start);
 	    PartialMessage.erase(PartialMessage.find_last_not_of("\r\n") + 1);
-	    List.push_back(PartialMessage);
+	    List.push_back(std::move(PartialMessage));
 	    PartialMessage.clear();
 	    while (NL2 < End && (*NL2 == '\n' || *NL2 == '\r')) ++NL2;
 	    Start = NL2;
@@ -914,6 +914,7 @@ void pkgDPkgPM::handleDisappearAction(string const &pkgname)
 	 // okay, they are strongly connected - transfer manual-bit
 	 if (Debug == true)
 	    std::clog << "transfer manual-bit from disappeared »" << pkgname << "« to »" << Tar.FullName() << "«" << std::endl;
+	 Cache.JournalPkgState(Tar->ID);
 	 Cache[Tar].Flags &= ~Flag::Auto;
 	 break;
       }
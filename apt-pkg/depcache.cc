@@ -29,16 +29,23 @@
 #include <apt-pkg/versionmatch.h>
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <iterator>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -105,12 +112,86 @@ int pkgDepCache::DecreaseActionGroupLevel()
 // ---------------------------------------------------------------------
 /* */
 
+namespace
+{
+// BitPlane - one bit per package, combined a machine word at a time	/*{{{*/
+class BitPlane
+{
+   std::vector<uint64_t> Words;
+
+   public:
+   explicit BitPlane(size_t const Count = 0) : Words((Count + 63) / 64) {}
+   void assign(size_t const Count) { Words.assign((Count + 63) / 64, 0); }
+   bool test(map_id_t const ID) const { return (Words[ID / 64] >> (ID % 64)) & 1; }
+   void set(map_id_t const ID) { Words[ID / 64] |= uint64_t{1} << (ID % 64); }
+   size_t count() const
+   {
+      size_t Count = 0;
+      for (auto const W : Words)
+	 Count += std::popcount(W);
+      return Count;
+   }
+   BitPlane &operator|=(BitPlane const &Other)
+   {
+      for (size_t I = 0; I < Words.size(); ++I)
+	 Words[I] |= Other.Words[I];
+      return *this;
+   }
+   BitPlane &andNot(BitPlane const &Other)
+   {
+      for (size_t I = 0; I < Words.size(); ++I)
+	 Words[I] &= ~Other.Words[I];
+      return *this;
+   }
+   // calls Func with the ID of each set bit in increasing order
+   template <typename Func>
+   void forEach(Func &&F) const
+   {
+      for (size_t I = 0; I < Words.size(); ++I)
+	 for (auto W = Words[I]; W != 0; W &= W - 1)
+	    F(static_cast<map_id_t>(I * 64 + std::countr_zero(W)));
+   }
+};
+									/*}}}*/
+} // namespace
+
 struct pkgDepCache::Private
 {
    std::unique_ptr<InRootSetFunc> inRootSetFunc;
    std::unique_ptr<APT::CacheFilter::Matcher> IsAVersionedKernelPackage, IsProtectedKernelPackage;
    std::string machineID;
    unsigned long iUpgradeCount{0};
+
+   /* All packages in the order of PkgBegin() with their ID, so passes over
+      all of them can skip most by their state without touching the cache.
+      Installed and Required are bit planes by ID describing the current
+      version, which doesn't change while the depcache exists. The planes
+      for the states are gathered by the passes themselves, as the
+      StateCache is public and written directly by its users. */
+   struct PackageEntry
+   {
+      map_id_t ID;
+      map_pointer<pkgCache::Package> Pkg;
+   };
+   std::vector<PackageEntry> Packages;
+   BitPlane Installed;
+   BitPlane Required;
+
+   // versions whose dependencies changed their state, see UpdateDepStates
+   std::vector<map_pointer<pkgCache::Version>> DirtyVersions;
+   std::vector<map_pointer<pkgCache::Package>> DirtyPackages;
+   bool const DebugConsistency{_config->FindB("Debug::pkgDepCache::Consistency", false)};
+
+   /* The previous values of the states changed while a Transaction is
+      open, in the order they were changed. Changes are recorded in the
+      innermost open transaction only, see Transaction::Private. */
+   struct Journal
+   {
+      Journal *Parent;
+      std::vector<std::pair<map_id_t, StateCache>> PkgStates;
+      std::vector<std::pair<map_id_t, unsigned char>> DepStates;
+   };
+   Journal *Undo{nullptr};
 };
 pkgDepCache::pkgDepCache(pkgCache *const pCache, Policy *const Plcy) : group_level(0), Cache(pCache), PkgState(0), DepState(0),
 								       iUsrSize(0), iDownloadSize(0), iInstCount(0), iDelCount(0), iKeepCount(0),
@@ -138,6 +219,9 @@ pkgDepCache::~pkgDepCache()
 									/*}}}*/
 bool pkgDepCache::CheckConsistency(char const *const msgtag)		/*{{{*/
 {
+   // the states computed here are thrown away, so there is nothing to record
+   auto const Undo = d->Undo;
+   d->Undo = nullptr;
    auto const OrigPkgState = PkgState;
    auto const OrigDepState = DepState;
 
@@ -216,6 +300,7 @@ bool pkgDepCache::CheckConsistency(char const *const msgtag)		/*{{{*/
    iBrokenCount = origBrokenCount;
    iPolicyBrokenCount = origPolicyBrokenCount;
    iBadCount = origBadCount;
+   d->Undo = Undo;
 
    return not inconsistent;
 }
@@ -229,6 +314,13 @@ bool pkgDepCache::Init(OpProgress * const Prog)
    // run a mark operation when Init terminates.
    ActionGroup actions(*this);
 
+   if (d->Undo != nullptr && PkgState != nullptr)
+   {
+      for (map_id_t I = 0; I < Head().PackageCount; ++I)
+	 JournalPkgState(I);
+      for (map_id_t I = 0; I < Head().DependsCount; ++I)
+	 JournalDepState(I);
+   }
    delete [] PkgState;
    delete [] DepState;
    PkgState = new StateCache[Head().PackageCount];
@@ -243,6 +335,11 @@ bool pkgDepCache::Init(OpProgress * const Prog)
       Prog->SubProgress(Head().PackageCount,_("Candidate versions"));
    }
 
+   d->Packages.clear();
+   d->Packages.reserve(Head().PackageCount);
+   d->Installed.assign(Head().PackageCount);
+   d->Required.assign(Head().PackageCount);
+
    /* Set the current state of everything. In this state all of the
       packages are kept exactly as is. See AllUpgrade */
    int Done = 0;
@@ -251,6 +348,14 @@ bool pkgDepCache::Init(OpProgress * const Prog)
       if (Prog != 0 && Done%20 == 0)
 	 Prog->Progress(Done);
 
+      d->Packages.push_back({I->ID, I.MapPointer()});
+      if (I->CurrentVer != 0)
+      {
+	 d->Installed.set(I->ID);
+	 if (I.CurrentVer()->Priority == pkgCache::State::Required)
+	    d->Required.set(I->ID);
+      }
+
       // Find the proper cache slot
       StateCache &State = PkgState[I->ID];
       State.iFlags = 0;
@@ -310,6 +415,7 @@ bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
 	 short const reason = section.FindI("Auto-Installed", 0);
 	 if(reason > 0)
 	 {
+	    JournalPkgState(pkg->ID);
 	    PkgState[pkg->ID].Flags |= Flag::Auto;
 	    if (unlikely(debug_autoremove))
 	       std::clog << "Auto-Installed : " << pkg.FullName() << std::endl;
@@ -318,7 +424,10 @@ bool pkgDepCache::readStateFile(OpProgress * const Prog)		/*{{{*/
 	       pkgCache::GrpIterator G = pkg.Group();
 	       for (pkg = G.NextPkg(pkg); pkg.end() != true; pkg = G.NextPkg(pkg))
 		  if (pkg->VersionList != 0)
+		  {
+		     JournalPkgState(pkg->ID);
 		     PkgState[pkg->ID].Flags |= Flag::Auto;
+		  }
 	    }
 	 }
 	 amt += section.size();
@@ -652,6 +761,7 @@ void pkgDepCache::BuildGroupOrs(VerIterator const &V)
    for (DepIterator D = V.DependsList(); D.end() != true; ++D)
    {
       // Build the dependency state.
+      JournalDepState(D->ID);
       unsigned char &State = DepState[D->ID];
 
       /* Invert for Conflicts. We have to do this twice to get the
@@ -733,6 +843,7 @@ unsigned char pkgDepCache::DependencyState(DepIterator const &D)
 void pkgDepCache::UpdateVerState(PkgIterator const &Pkg)
 {   
    // Empty deps are always true
+   JournalPkgState(Pkg->ID);
    StateCache &State = PkgState[Pkg->ID];
    State.DepState = 0xFF;
    
@@ -788,6 +899,7 @@ void pkgDepCache::PerformDependencyPass(OpProgress * const Prog)
 	 for (DepIterator D = V.DependsList(); D.end() != true; ++D)
 	 {
 	    // Build the dependency state.
+	    JournalDepState(D->ID);
 	    unsigned char &State = DepState[D->ID];
 	    State = DependencyState(D);
 
@@ -823,21 +935,75 @@ void pkgDepCache::Update(OpProgress * const Prog)
    It is mainly meant to scan reverse dependencies. */
 void pkgDepCache::Update(DepIterator D)
 {
-   // Update the reverse deps
+   UpdateDepStates(D);
+   UpdateDirtyVersions();
+}
+									/*}}}*/
+// DepCache::UpdateDepStates - Update the states of a list of deps	/*{{{*/
+// ---------------------------------------------------------------------
+/* Only the versions with a dependency whose state changed are remembered,
+   the states derived from it are recomputed once per version and package
+   by UpdateDirtyVersions. Most reverse dependencies of a package do not
+   change their state if it is marked, so their parents are left alone. */
+void pkgDepCache::UpdateDepStates(DepIterator D)
+{
    for (;D.end() != true; ++D)
-   {      
-      unsigned char &State = DepState[D->ID];
-      State = DependencyState(D);
-    
-      // Invert for Conflicts
-      if (D.IsNegative() == true)
-	 State = ~State;
+      UpdateDepState(D);
+}
+void pkgDepCache::UpdateDepState(DepIterator const &D)
+{
+   unsigned char NewState = DependencyState(D);
+
+   // Invert for Conflicts
+   if (D.IsNegative() == true)
+      NewState = ~NewState;
+
+   // the bits for the or-group are derived from these by BuildGroupOrs
+   unsigned char &State = DepState[D->ID];
+   if (((State ^ NewState) & 0x7) == 0)
+      return;
+   JournalDepState(D->ID);
+   State = NewState;
+   d->DirtyVersions.push_back(D->ParentVer);
+}
+/* The reverse dependencies are taken from the index of the cache if it
+   has one rather than following the list through the cache. */
+void pkgDepCache::UpdateRevDepStates(PkgIterator const &Pkg)
+{
+   if (Cache->HasReverseIndex() == false)
+      return UpdateDepStates(Pkg.RevDependsList());
+   for (auto const Dep : Cache->RevDepends(Pkg))
+      UpdateDepState(DepIterator(*Cache, Cache->DepP + Dep, Cache->PkgP));
+}
+									/*}}}*/
+// DepCache::UpdateDirtyVersions - Update the states depending on deps	/*{{{*/
+void pkgDepCache::UpdateDirtyVersions()
+{
+   auto &Vers = d->DirtyVersions;
+   if (Vers.empty())
+      return;
+   std::sort(Vers.begin(), Vers.end());
+   Vers.erase(std::unique(Vers.begin(), Vers.end()), Vers.end());
 
-      RemoveStates(D.ParentPkg());
-      BuildGroupOrs(D.ParentVer());
-      UpdateVerState(D.ParentPkg());
-      AddStates(D.ParentPkg());
+   auto &Pkgs = d->DirtyPackages;
+   for (auto const V : Vers)
+   {
+      VerIterator const Ver(*Cache, Cache->VerP + V);
+      BuildGroupOrs(Ver);
+      Pkgs.push_back(Ver->ParentPkg);
+   }
+   std::sort(Pkgs.begin(), Pkgs.end());
+   Pkgs.erase(std::unique(Pkgs.begin(), Pkgs.end()), Pkgs.end());
+
+   for (auto const P : Pkgs)
+   {
+      PkgIterator const Pkg(*Cache, Cache->PkgP + P);
+      RemoveStates(Pkg);
+      UpdateVerState(Pkg);
+      AddStates(Pkg);
    }
+   Vers.clear();
+   Pkgs.clear();
 }
 									/*}}}*/
 // DepCache::Update - Update the related deps of a package		/*{{{*/
@@ -852,19 +1018,24 @@ void pkgDepCache::Update(PkgIterator const &Pkg)
    AddStates(Pkg);
    
    // Update the reverse deps
-   Update(Pkg.RevDependsList());
+   UpdateRevDepStates(Pkg);
 
    // Update the provides map for the current ver
    auto const CurVer = Pkg.CurrentVer();
    if (not CurVer.end())
       for (PrvIterator P = CurVer.ProvidesList(); not P.end(); ++P)
-	 Update(P.ParentPkg().RevDependsList());
+	 UpdateRevDepStates(P.ParentPkg());
 
    // Update the provides map for the candidate ver
    auto const CandVer = PkgState[Pkg->ID].CandidateVerIter(*this);
    if (not CandVer.end() && CandVer != CurVer)
       for (PrvIterator P = CandVer.ProvidesList(); not P.end(); ++P)
-	 Update(P.ParentPkg().RevDependsList());
+	 UpdateRevDepStates(P.ParentPkg());
+
+   UpdateDirtyVersions();
+
+   if (unlikely(d->DebugConsistency))
+      CheckConsistency(Pkg.FullName().c_str());
 }
 									/*}}}*/
 // DepCache::IsModeChangeOk - check if it is ok to change the mode	/*{{{*/
@@ -968,6 +1139,7 @@ bool pkgDepCache::MarkKeep(PkgIterator const &Pkg, bool Soft, bool FromUser,
    if (P.Mode == ModeKeep)
       return true;
 
+   JournalPkgState(Pkg->ID);
    if (Soft == true)
       P.iFlags |= AutoKept;
    else
@@ -1025,6 +1197,7 @@ bool pkgDepCache::MarkDelete(PkgIterator const &Pkg, bool rPurge,
    if (IsDeleteOk(Pkg,rPurge,Depth,FromUser) == false)
       return false;
 
+   JournalPkgState(Pkg->ID);
    P.iFlags &= ~(AutoKept | Purge);
    if (rPurge == true)
       P.iFlags |= Purge;
@@ -1207,6 +1380,7 @@ bool pkgDepCache::MarkInstall_StateChange(pkgCache::PkgIterator const &Pkg, bool
    if (P.Protect() && P.InstallVer == P.CandidateVer)
       return true;
 
+   JournalPkgState(Pkg->ID);
    P.iFlags &= ~pkgDepCache::AutoKept;
 
    /* Target the candidate version and remove the autoflag. We reset the
@@ -1243,6 +1417,7 @@ bool pkgDepCache::MarkInstall_StateChange(pkgCache::PkgIterator const &Pkg, bool
 									/*}}}*/
 static bool MarkInstall_DiscardCandidate(pkgDepCache &Cache, pkgCache::PkgIterator const &Pkg) /*{{{*/
 {
+   Cache.JournalPkgState(Pkg->ID);
    auto &State = Cache[Pkg];
    State.CandidateVer = State.InstallVer;
    auto const oldStatus = State.Status;
@@ -1256,6 +1431,7 @@ bool pkgDepCache::MarkInstall_DiscardInstall(pkgCache::PkgIterator const &Pkg) /
    StateCache &State = PkgState[Pkg->ID];
    if (State.Mode == ModeKeep && State.InstallVer == State.CandidateVer && State.CandidateVer == Pkg.CurrentVer())
       return true;
+   JournalPkgState(Pkg->ID);
    RemoveSizes(Pkg);
    RemoveStates(Pkg);
    if (Pkg->CurrentVer != 0)
@@ -1716,6 +1892,9 @@ bool pkgDepCache::MarkInstall(PkgIterator const &Pkg, bool AutoInst,
    if (DebugMarker)
       std::clog << OutputInDepth(Depth) << "MarkInstall " << APT::PrettyPkg(this, Pkg) << " FU=" << FromUser << '\n';
 
+   // the flag is only set while the dependencies are marked
+   if (not P.Protect())
+      JournalPkgState(Pkg->ID);
    class ScopedProtected
    {
       pkgDepCache::StateCache &P;
@@ -1853,6 +2032,7 @@ bool pkgDepCache::IsInstallOkMultiArchSameVersionSynced(PkgIterator const &Pkg,
       if (CV.Downloadable() == false)
 	 continue;
 
+      JournalPkgState(Pkg->ID);
       PkgState[Pkg->ID].iFlags |= AutoKept;
       if (unlikely(DebugMarker == true))
 	 std::clog << OutputInDepth(Depth) << "Ignore MarkInstall of " << APT::PrettyPkg(this, Pkg)
@@ -1898,6 +2078,7 @@ bool pkgDepCache::IsInstallOkDependenciesSatisfiableByCandidates(PkgIterator con
       StateCache &State = PkgState[Pkg->ID];
       if (not State.Protect())
       {
+	 JournalPkgState(Pkg->ID);
 	 if (Pkg->CurrentVer != 0)
 	    SetCandidateVersion(Pkg.CurrentVer());
 	 else
@@ -1943,6 +2124,7 @@ void pkgDepCache::SetReInstall(PkgIterator const &Pkg,bool To)
       RemoveSizes(Pkg);
       RemoveStates(Pkg);
 
+      JournalPkgState(Pkg->ID);
       StateCache &P = PkgState[Pkg->ID];
       if (To == true)
 	 P.iFlags |= ReInstall;
@@ -1972,6 +2154,7 @@ void pkgDepCache::SetCandidateVersion(VerIterator TargetVer)
 
    ActionGroup group(*this);
 
+   JournalPkgState(Pkg->ID);
    RemoveSizes(Pkg);
    RemoveStates(Pkg);
 
@@ -2163,12 +2346,20 @@ void pkgDepCache::MarkAuto(const PkgIterator &Pkg, bool Auto)
 
   ActionGroup group(*this);
 
+  JournalPkgState(Pkg->ID);
   if(Auto)
     state.Flags |= Flag::Auto;
   else
     state.Flags &= ~Flag::Auto;
 }
 									/*}}}*/
+// DepCache::MarkProtected - Protect the state from automatic changes	/*{{{*/
+void pkgDepCache::MarkProtected(PkgIterator const &Pkg)
+{
+   JournalPkgState(Pkg->ID);
+   PkgState[Pkg->ID].iFlags |= Protected;
+}
+									/*}}}*/
 // StateCache::Update - Compute the various static display things	/*{{{*/
 // ---------------------------------------------------------------------
 /* This is called whenever the Candidate version changes. */
@@ -2310,39 +2501,68 @@ static bool IsPkgInBoringState(pkgCache::PkgIterator const &Pkg, pkgDepCache::St
    return false;
 }
 									/*}}}*/
-// MarkPackage - mark a single package in Mark-and-Sweep		/*{{{*/
-static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
-			pkgCache::VerIterator const &Ver,
-			bool const follow_recommends,
-			bool const follow_suggests,
-			bool const debug_autoremove,
-			std::string_view const reason,
-			size_t const Depth,
-			pkgCache &Cache,
-			pkgDepCache &DepCache,
-			pkgDepCache::StateCache *const PkgState,
-			std::vector<bool> &fullyExplored,
-			std::unique_ptr<APT::CacheFilter::Matcher> &IsAVersionedKernelPackage,
-			std::unique_ptr<APT::CacheFilter::Matcher> &IsProtectedKernelPackage)
+// Mark states - the mark bits used while marking			/*{{{*/
+namespace
 {
-   if (Ver.end() || PkgState[Pkg->ID].Marked)
-      return true;
+// marking sequentially uses the Marked field of the states directly
+struct SerialMarkState
+{
+   pkgDepCache::StateCache *const PkgState;
+   std::vector<bool> fullyExplored;
 
-   if (IsPkgInBoringState(Pkg, PkgState))
+   SerialMarkState(pkgDepCache::StateCache *const PkgState, size_t const Count) : PkgState(PkgState), fullyExplored(Count, false) {}
+   bool IsMarked(map_id_t const ID) const { return PkgState[ID].Marked; }
+   void SetMarked(map_id_t const ID) { PkgState[ID].Marked = true; }
+   bool IsExplored(map_id_t const ID) const { return fullyExplored[ID]; }
+   void SetExplored(map_id_t const ID) { fullyExplored[ID] = true; }
+   std::unique_lock<std::mutex> LockMatchers() { return {}; }
+};
+/* marking in parallel uses atomic bits instead which are copied into the
+   states at the end. A package is explored by the thread which claimed its
+   mark bit, so every package is explored exactly once. */
+struct ParallelMarkState
+{
+   enum : uint8_t
    {
-      fullyExplored[Pkg->ID] = true;
-      return true;
-   }
-
-   // we are not trying too hard…
-   if (unlikely(Depth > 3000))
-      return false;
-
-   PkgState[Pkg->ID].Marked = true;
-   if(debug_autoremove)
-      std::clog << "Marking: " << Pkg.FullName() << " " << Ver.VerStr()
-		<< " (" << reason << ")" << std::endl;
+      Marked = 1 << 0,
+      Explored = 1 << 1,
+   };
+   std::unique_ptr<std::atomic<uint8_t>[]> Bits;
+   std::mutex Matchers;
 
+   explicit ParallelMarkState(size_t const Count) : Bits(new std::atomic<uint8_t>[Count]())
+   {
+      for (size_t I = 0; I < Count; ++I)
+	 Bits[I].store(0, std::memory_order_relaxed);
+   }
+   bool IsMarked(map_id_t const ID) const { return (Bits[ID].load() & Marked) != 0; }
+   void SetMarked(map_id_t const ID) { Bits[ID].fetch_or(Marked); }
+   bool Claim(map_id_t const ID) { return (Bits[ID].fetch_or(Marked) & Marked) == 0; }
+   bool IsExplored(map_id_t const ID) const { return (Bits[ID].load() & Explored) != 0; }
+   void SetExplored(map_id_t const ID) { Bits[ID].fetch_or(Explored); }
+   // the kernel matchers are created lazily and not safe to share
+   std::unique_lock<std::mutex> LockMatchers() { return std::unique_lock<std::mutex>(Matchers); }
+};
+} // namespace
+									/*}}}*/
+// MarkDependencies - find the providers to follow for a version	/*{{{*/
+/* Calls Follow(Dep, ProviderVer, Sources, Providers) for each version which
+   is needed to satisfy the dependencies of Ver and stops if it returns
+   false. Which versions these are depends only on the states of the
+   packages, not on what was marked before, so the result of the mark
+   phase doesn't depend on the order the packages are explored in. */
+template <class MarkState, class FollowFunc>
+static bool MarkDependencies(pkgCache::VerIterator const &Ver,
+			     bool const follow_recommends,
+			     bool const follow_suggests,
+			     pkgCache &Cache,
+			     pkgDepCache &DepCache,
+			     pkgDepCache::StateCache *const PkgState,
+			     MarkState &Marks,
+			     std::unique_ptr<APT::CacheFilter::Matcher> &IsAVersionedKernelPackage,
+			     std::unique_ptr<APT::CacheFilter::Matcher> &IsProtectedKernelPackage,
+			     FollowFunc &&Follow)
+{
    auto const sort_by_source_version = [](pkgCache::VerIterator const &A, pkgCache::VerIterator const &B) {
       auto const verret = A.Cache()->VS->CmpVersion(A.SourceVerStr(), B.SourceVerStr());
       if (verret != 0)
@@ -2353,7 +2573,7 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
    for (auto D = Ver.DependsList(); not D.end(); ++D)
    {
       auto const T = D.TargetPkg();
-      if (T.end() || fullyExplored[T->ID])
+      if (T.end() || Marks.IsExplored(T->ID))
 	 continue;
 
       if (D->Type != pkgCache::Dep::Depends &&
@@ -2377,7 +2597,7 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 	 }
       }
       if (providers_by_source.empty() && not unsatisfied_choice)
-	 PkgState[T->ID].Marked = true;
+	 Marks.SetMarked(T->ID);
       // collect virtual part
       for (auto Prv = T.ProvidesList(); not Prv.end(); ++Prv)
       {
@@ -2404,6 +2624,7 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
 	 // if the provider is a versioned kernel package mark them only for protected kernels
 	 if (providers.second.size() == 1)
 	    continue;
+	 auto const MatchersGuard = Marks.LockMatchers();
 	 if (not IsAVersionedKernelPackage)
 	    IsAVersionedKernelPackage = [&]() -> std::unique_ptr<APT::CacheFilter::Matcher> {
 	       auto const patterns = _config->FindVector("APT::VersionedKernelPackages");
@@ -2428,7 +2649,7 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
       }
 
       if (not unsatisfied_choice)
-	 fullyExplored[T->ID] = true;
+	 Marks.SetExplored(T->ID);
 
       // do not follow newly installed providers if we have already installed providers
       if (providers_by_source.size() >= 2)
@@ -2449,24 +2670,193 @@ static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
       }
 
       for (auto const &providers : providers_by_source)
-      {
 	 for (auto const &PV : providers.second)
+	    if (not Follow(D, PV, providers_by_source.size(), providers.second.size()))
+	       return false;
+   }
+   return true;
+}
+									/*}}}*/
+// MarkPackage - mark a single package in Mark-and-Sweep		/*{{{*/
+static bool MarkPackage(pkgCache::PkgIterator const &Pkg,
+			pkgCache::VerIterator const &Ver,
+			bool const follow_recommends,
+			bool const follow_suggests,
+			bool const debug_autoremove,
+			std::string_view const reason,
+			size_t const Depth,
+			pkgCache &Cache,
+			pkgDepCache &DepCache,
+			pkgDepCache::StateCache *const PkgState,
+			SerialMarkState &Marks,
+			std::unique_ptr<APT::CacheFilter::Matcher> &IsAVersionedKernelPackage,
+			std::unique_ptr<APT::CacheFilter::Matcher> &IsProtectedKernelPackage)
+{
+   if (Ver.end() || Marks.IsMarked(Pkg->ID))
+      return true;
+
+   if (IsPkgInBoringState(Pkg, PkgState))
+   {
+      Marks.SetExplored(Pkg->ID);
+      return true;
+   }
+
+   // we are not trying too hard…
+   if (unlikely(Depth > 3000))
+      return false;
+
+   Marks.SetMarked(Pkg->ID);
+   if(debug_autoremove)
+      std::clog << "Marking: " << Pkg.FullName() << " " << Ver.VerStr()
+		<< " (" << reason << ")" << std::endl;
+
+   return MarkDependencies(Ver, follow_recommends, follow_suggests, Cache, DepCache, PkgState, Marks,
+			   IsAVersionedKernelPackage, IsProtectedKernelPackage,
+			   [&](pkgCache::DepIterator const &D, pkgCache::VerIterator const &PV, size_t const Sources, size_t const Providers) {
+	 auto const PP = PV.ParentPkg();
+	 if (debug_autoremove)
+	    std::clog << "Following dep: " << APT::PrettyDep(&DepCache, D)
+		      << ", provided by " << PP.FullName() << " " << PV.VerStr()
+		      << " (" << Sources << "/" << Providers << ")\n";
+	 return MarkPackage(PP, PV, follow_recommends, follow_suggests, debug_autoremove,
+			    "Dependency", Depth + 1, Cache, DepCache, PkgState, Marks,
+			    IsAVersionedKernelPackage, IsProtectedKernelPackage);
+      });
+}
+									/*}}}*/
+// MarkInParallel - mark everything reachable from the roots		/*{{{*/
+/* Each thread does a depth first search on its own stack and moves half of
+   it into the shared pool while another thread is idle. A version is only
+   pushed by the thread which claimed the mark bit of its package, so this
+   marks the same packages as MarkPackage does, just in another order.
+   Returns false without a result if the threads could not be started. */
+static bool MarkInParallel(std::vector<pkgCache::VerIterator> &&Roots,
+			   unsigned const Threads,
+			   bool const follow_recommends,
+			   bool const follow_suggests,
+			   pkgCache &Cache,
+			   pkgDepCache &DepCache,
+			   pkgDepCache::StateCache *const PkgState,
+			   ParallelMarkState &Marks,
+			   std::unique_ptr<APT::CacheFilter::Matcher> &IsAVersionedKernelPackage,
+			   std::unique_ptr<APT::CacheFilter::Matcher> &IsProtectedKernelPackage)
+{
+   std::mutex Lock;
+   std::condition_variable Wakeup;
+   std::vector<pkgCache::VerIterator> Shared = std::move(Roots);
+   std::atomic<unsigned> Idle{0};
+   bool Done = false;
+
+   auto const Worker = [&]() {
+      std::vector<pkgCache::VerIterator> Stack;
+      while (true)
+      {
+	 if (Stack.empty())
 	 {
+	    std::unique_lock<std::mutex> Guard(Lock);
+	    ++Idle;
+	    while (Shared.empty() && not Done)
+	    {
+	       // nobody is left who could produce more work
+	       if (Idle == Threads)
+	       {
+		  Done = true;
+		  Wakeup.notify_all();
+	       }
+	       else
+		  Wakeup.wait(Guard);
+	    }
+	    --Idle;
+	    if (Done)
+	       return;
+	    auto const Take = std::max<size_t>(1, Shared.size() / Threads);
+	    Stack.assign(Shared.end() - Take, Shared.end());
+	    Shared.erase(Shared.end() - Take, Shared.end());
+	 }
+
+	 auto const Ver = Stack.back();
+	 Stack.pop_back();
+	 MarkDependencies(Ver, follow_recommends, follow_suggests, Cache, DepCache, PkgState, Marks,
+			  IsAVersionedKernelPackage, IsProtectedKernelPackage,
+			  [&](pkgCache::DepIterator const &, pkgCache::VerIterator const &PV, size_t, size_t) {
 	    auto const PP = PV.ParentPkg();
-	    if (debug_autoremove)
-	       std::clog << "Following dep: " << APT::PrettyDep(&DepCache, D)
-			 << ", provided by " << PP.FullName() << " " << PV.VerStr()
-			 << " (" << providers_by_source.size() << "/" << providers.second.size() << ")\n";
-	    if (not MarkPackage(PP, PV, follow_recommends, follow_suggests, debug_autoremove,
-				"Dependency", Depth + 1, Cache, DepCache, PkgState, fullyExplored,
-				IsAVersionedKernelPackage, IsProtectedKernelPackage))
-	       return false;
+	    if (IsPkgInBoringState(PP, PkgState))
+	       Marks.SetExplored(PP->ID);
+	    else if (Marks.Claim(PP->ID))
+	       Stack.push_back(PV);
+	    return true;
+	 });
+
+	 if (Stack.size() > 1 && Idle != 0)
+	 {
+	    std::lock_guard<std::mutex> Guard(Lock);
+	    auto const Half = Stack.begin() + Stack.size() / 2;
+	    Shared.insert(Shared.end(), Stack.begin(), Half);
+	    Stack.erase(Stack.begin(), Half);
+	    Wakeup.notify_all();
 	 }
       }
+   };
+
+   std::vector<std::thread> Helpers;
+   try
+   {
+      for (unsigned I = 1; I < Threads; ++I)
+	 Helpers.emplace_back(Worker);
    }
+   catch (std::system_error const &)
+   {
+      {
+	 std::lock_guard<std::mutex> Guard(Lock);
+	 Done = true;
+	 Wakeup.notify_all();
+      }
+      for (auto &H : Helpers)
+	 H.join();
+      return false;
+   }
+   Worker();
+   for (auto &H : Helpers)
+      H.join();
    return true;
 }
 									/*}}}*/
+// MarksJournal - record the flags changed by mark and sweep		/*{{{*/
+/* A run touches the flags of nearly all packages, but changes only a few
+   of them, so these are found by comparing with a copy at the end. */
+class MarksJournal
+{
+   pkgDepCache &Cache;
+   pkgDepCache::StateCache *const PkgState;
+   std::vector<bool> Marked, Garbage;
+
+   public:
+   MarksJournal(pkgDepCache &Cache, pkgDepCache::StateCache *const PkgState, size_t const Count, bool const Active) : Cache(Cache), PkgState(PkgState)
+   {
+      if (not Active)
+	 return;
+      Marked.resize(Count);
+      Garbage.resize(Count);
+      for (size_t I = 0; I < Count; ++I)
+      {
+	 Marked[I] = PkgState[I].Marked;
+	 Garbage[I] = PkgState[I].Garbage;
+      }
+   }
+   ~MarksJournal()
+   {
+      for (size_t I = 0; I < Marked.size(); ++I)
+      {
+	 if (PkgState[I].Marked == Marked[I] && PkgState[I].Garbage == Garbage[I])
+	    continue;
+	 auto Old = PkgState[I];
+	 Old.Marked = Marked[I];
+	 Old.Garbage = Garbage[I];
+	 Cache.JournalPkgState(I, Old);
+      }
+   }
+};
+									/*}}}*/
 // pkgDepCache::MarkRequired - the main mark algorithm			/*{{{*/
 bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
 {
@@ -2475,12 +2865,16 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
 
    // init the states
    auto const PackagesCount = Head().PackageCount;
+   MarksJournal const Journal(*this, PkgState, PackagesCount, d->Undo != nullptr);
+   // only packages which are or will be installed can be roots (see IsPkgInBoringState)
+   BitPlane Live(PackagesCount);
    for(auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
    {
       PkgState[i].Marked  = false;
       PkgState[i].Garbage = false;
+      if (d->Installed.test(i) ? not PkgState[i].Delete() : not PkgState[i].Keep())
+	 Live.set(i);
    }
-   std::vector<bool> fullyExplored(PackagesCount, false);
 
    bool const debug_autoremove = _config->FindB("Debug::pkgAutoRemove", false);
    if (debug_autoremove)
@@ -2491,33 +2885,79 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
    bool const follow_recommends = MarkFollowsRecommends();
    bool const follow_suggests   = MarkFollowsSuggests();
 
-   // do the mark part, this is the core bit of the algorithm
-   for (PkgIterator P = PkgBegin(); !P.end(); ++P)
+   /* Small graphs are done before the threads would be started and the
+      debug output is only meaningful in the order of the sequential search */
+   unsigned Threads = 1;
+   if (not debug_autoremove && not DebugMarker)
    {
-      if (PkgState[P->ID].Marked || IsPkgInBoringState(P, PkgState))
-	 continue;
+      int const Configured = _config->FindI("APT::AutoRemove::Threads", 0);
+      if (Configured > 0)
+	 Threads = Configured;
+      else if (Configured == 0)
+      {
+	 if (Live.count() >= 2000)
+	    Threads = std::min(std::thread::hardware_concurrency(), 8u);
+      }
+      Threads = std::max(Threads, 1u);
+   }
 
-      std::string_view reason;
-      if ((PkgState[P->ID].Flags & Flag::Auto) == 0)
-	 reason = "Manual-Installed";
-      else if (P->Flags & Flag::Essential)
-	 reason = "Essential";
-      else if (P->Flags & Flag::Important)
-	 reason = "Important";
-      else if (P->CurrentVer != 0 && P.CurrentVer()->Priority == pkgCache::State::Required)
-	 reason = "Required";
-      else if (userFunc.InRootSet(P))
-	 reason = "Blacklisted [APT::NeverAutoRemove]";
-      else if (not IsModeChangeOk(*this, ModeGarbage, P, 0, false, DebugMarker))
-	 reason = "Hold";
-      else
-	 continue;
+   SerialMarkState SerialMarks(PkgState, PackagesCount);
+   std::unique_ptr<ParallelMarkState> ParallelMarks;
+   std::vector<pkgCache::VerIterator> Roots;
+   if (Threads > 1)
+      ParallelMarks = std::make_unique<ParallelMarkState>(PackagesCount);
 
-      pkgCache::VerIterator const PV = (PkgState[P->ID].Install()) ? PkgState[P->ID].InstVerIter(*this) : P.CurrentVer();
-      if (not MarkPackage(P, PV, follow_recommends, follow_suggests, debug_autoremove,
-			  reason, 0, *Cache, *this, PkgState, fullyExplored,
-			  d->IsAVersionedKernelPackage, d->IsProtectedKernelPackage))
-	 return false;
+   // do the mark part, this is the core bit of the algorithm
+   auto const MarkRoots = [&]() {
+      for (auto const &E : d->Packages)
+      {
+	 if (not Live.test(E.ID) || PkgState[E.ID].Marked)
+	    continue;
+	 PkgIterator const P(*Cache, Cache->PkgP + E.Pkg);
+
+	 std::string_view reason;
+	 if ((PkgState[P->ID].Flags & Flag::Auto) == 0)
+	    reason = "Manual-Installed";
+	 else if (P->Flags & Flag::Essential)
+	    reason = "Essential";
+	 else if (P->Flags & Flag::Important)
+	    reason = "Important";
+	 else if (P->CurrentVer != 0 && P.CurrentVer()->Priority == pkgCache::State::Required)
+	    reason = "Required";
+	 else if (userFunc.InRootSet(P))
+	    reason = "Blacklisted [APT::NeverAutoRemove]";
+	 else if (not IsModeChangeOk(*this, ModeGarbage, P, 0, false, DebugMarker))
+	    reason = "Hold";
+	 else
+	    continue;
+
+	 pkgCache::VerIterator const PV = (PkgState[P->ID].Install()) ? PkgState[P->ID].InstVerIter(*this) : P.CurrentVer();
+	 if (ParallelMarks != nullptr)
+	 {
+	    if (not PV.end() && ParallelMarks->Claim(P->ID))
+	       Roots.push_back(PV);
+	 }
+	 else if (not MarkPackage(P, PV, follow_recommends, follow_suggests, debug_autoremove,
+				  reason, 0, *Cache, *this, PkgState, SerialMarks,
+				  d->IsAVersionedKernelPackage, d->IsProtectedKernelPackage))
+	    return false;
+      }
+      return true;
+   };
+   if (not MarkRoots())
+      return false;
+
+   if (ParallelMarks != nullptr)
+   {
+      if (not MarkInParallel(std::move(Roots), Threads, follow_recommends, follow_suggests, *Cache, *this, PkgState,
+			     *ParallelMarks, d->IsAVersionedKernelPackage, d->IsProtectedKernelPackage))
+      {
+	 // no threads for us, so mark everything in this one instead
+	 ParallelMarks.reset();
+	 return MarkRoots();
+      }
+      for (auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
+	 PkgState[i].Marked = ParallelMarks->IsMarked(i);
    }
    return true;
 }
@@ -2525,25 +2965,33 @@ bool pkgDepCache::MarkRequired(InRootSetFunc &userFunc)
 bool pkgDepCache::Sweep()						/*{{{*/
 {
    bool debug_autoremove = _config->FindB("Debug::pkgAutoRemove",false);
+   auto const PackagesCount = Head().PackageCount;
+   MarksJournal const Journal(*this, PkgState, PackagesCount, d->Undo != nullptr);
 
-   // do the sweep
-   for(PkgIterator p=PkgBegin(); !p.end(); ++p)
+   // if it is installed (or will be) and neither marked nor required, it's garbage
+   BitPlane Garbage(PackagesCount), Marked(PackagesCount);
+   for (auto i = decltype(PackagesCount){0}; i < PackagesCount; ++i)
    {
-     StateCache &state=PkgState[p->ID];
-
-     // skip required packages
-     if (!p.CurrentVer().end() && 
-	 (p.CurrentVer()->Priority == pkgCache::State::Required))
-	continue;
+      if (PkgState[i].Install())
+	 Garbage.set(i);
+      if (PkgState[i].Marked)
+	 Marked.set(i);
+   }
+   Garbage |= d->Installed;
+   Garbage.andNot(Marked).andNot(d->Required);
 
-     // if it is not marked and it is installed, it's garbage 
-     if(!state.Marked && (!p.CurrentVer().end() || state.Install()))
-     {
-	state.Garbage=true;
-	if(debug_autoremove)
-	   std::clog << "Garbage: " << p.FullName() << std::endl;
-     }
-  }   
+   // the debug output lists the packages in the usual order
+   if (debug_autoremove)
+   {
+      for (auto const &E : d->Packages)
+	 if (Garbage.test(E.ID))
+	 {
+	    PkgState[E.ID].Garbage = true;
+	    std::clog << "Garbage: " << PkgIterator(*Cache, Cache->PkgP + E.Pkg).FullName() << std::endl;
+	 }
+   }
+   else
+      Garbage.forEach([&](map_id_t const ID) { PkgState[ID].Garbage = true; });
 
    return true;
 }
@@ -2664,7 +3112,41 @@ unsigned long pkgDepCache::UpgradeCount()
    return d->iUpgradeCount;
 }
 									/*}}}*/
+// pkgDepCache::Journal*State - remember states for the open transaction	/*{{{*/
+void pkgDepCache::JournalPkgState(map_id_t const ID)
+{
+   if (d->Undo != nullptr)
+      d->Undo->PkgStates.emplace_back(ID, PkgState[ID]);
+}
+void pkgDepCache::JournalPkgState(map_id_t const ID, StateCache const &State)
+{
+   if (d->Undo != nullptr)
+      d->Undo->PkgStates.emplace_back(ID, State);
+}
+void pkgDepCache::JournalDepState(map_id_t const ID)
+{
+   if (d->Undo != nullptr)
+      d->Undo->DepStates.emplace_back(ID, DepState[ID]);
+}
+void pkgDepCache::SetMarkFlags(PkgIterator const &Pkg, bool const Marked, bool const Garbage)
+{
+   StateCache &State = PkgState[Pkg->ID];
+   if (State.Marked == Marked && State.Garbage == Garbage)
+      return;
+   JournalPkgState(Pkg->ID);
+   State.Marked = Marked;
+   State.Garbage = Garbage;
+}
+									/*}}}*/
 // pkgDepCache::Transaction						/*{{{*/
+/* Each transaction records the previous values of the states changed while
+   it is the innermost open one. Committing hands these over to the
+   enclosing transaction, rolling back restores them in reverse order, so
+   the oldest recorded value of a state is the one which remains.
+   With Undo::COPY the states are restored from a copy instead, so changes
+   made via operator[] without recording them are undone as well. Such a
+   transaction installs no journal of its own, so nothing is recorded (and
+   grows) while only copying transactions are open. */
 struct pkgDepCache::Transaction::Private
 {
    template <typename T>
@@ -2677,8 +3159,9 @@ struct pkgDepCache::Transaction::Private
    // State information
    pkgDepCache &cache;
    Behavior behavior;
-   std::unique_ptr<StateCache[]> PkgState{copyArray(cache.PkgState, cache.GetCache().Head().PackageCount)};
-   std::unique_ptr<unsigned char[]> DepState{copyArray(cache.DepState, cache.GetCache().Head().DependsCount)};
+   pkgDepCache::Private::Journal Journal{cache.d->Undo, {}, {}};
+   std::unique_ptr<StateCache[]> PkgState;
+   std::unique_ptr<unsigned char[]> DepState;
    signed long long iUsrSize{cache.iUsrSize};
    unsigned long long iDownloadSize{cache.iDownloadSize};
    unsigned long iInstCount{cache.iInstCount};
@@ -2689,10 +3172,43 @@ struct pkgDepCache::Transaction::Private
    unsigned long iPolicyBrokenCount{cache.iPolicyBrokenCount};
    unsigned long iBadCount{cache.iBadCount};
 
+   Private(pkgDepCache &cache, Behavior const behavior, Undo const undo) : cache(cache), behavior(behavior)
+   {
+      if (undo == Undo::COPY)
+      {
+	 PkgState.reset(copyArray(cache.PkgState, cache.GetCache().Head().PackageCount));
+	 DepState.reset(copyArray(cache.DepState, cache.GetCache().Head().DependsCount));
+      }
+      else
+	 cache.d->Undo = &Journal;
+   }
+
    void rollback()
    {
-      memcpy(&cache.PkgState[0], &PkgState[0], sizeof(PkgState[0]) * cache.GetCache().Head().PackageCount);
-      memcpy(&cache.DepState[0], &DepState[0], sizeof(DepState[0]) * cache.GetCache().Head().DependsCount);
+      // an open inner transaction has to be able to undo the rollback
+      bool const Innermost = cache.d->Undo == &Journal;
+      if (PkgState != nullptr)
+      {
+	 auto const PackageCount = cache.GetCache().Head().PackageCount;
+	 auto const DependsCount = cache.GetCache().Head().DependsCount;
+	 // open journals of other transactions have to be able to undo it
+	 if (cache.d->Undo != nullptr)
+	 {
+	    for (map_id_t I = 0; I < PackageCount; ++I)
+	       cache.JournalPkgState(I);
+	    for (map_id_t I = 0; I < DependsCount; ++I)
+	       cache.JournalDepState(I);
+	 }
+	 memcpy(&cache.PkgState[0], &PkgState[0], sizeof(PkgState[0]) * PackageCount);
+	 memcpy(&cache.DepState[0], &DepState[0], sizeof(DepState[0]) * DependsCount);
+      }
+      else
+	 rollbackJournal(Innermost);
+      if (Innermost)
+      {
+	 Journal.PkgStates.clear();
+	 Journal.DepStates.clear();
+      }
 
       cache.iUsrSize = iUsrSize;
       cache.iDownloadSize = iDownloadSize;
@@ -2704,9 +3220,58 @@ struct pkgDepCache::Transaction::Private
       cache.iPolicyBrokenCount = iPolicyBrokenCount;
       cache.iBadCount = iBadCount;
    }
+
+   void rollbackJournal(bool const Innermost)
+   {
+      /* transactions opened within this one have changes to undo as well,
+	 which are newer than ours, so they are restored first */
+      decltype(Journal.PkgStates) PkgStates;
+      decltype(Journal.DepStates) DepStates;
+      for (auto J = cache.d->Undo; J != nullptr; J = J->Parent)
+      {
+	 PkgStates.insert(PkgStates.end(), J->PkgStates.rbegin(), J->PkgStates.rend());
+	 DepStates.insert(DepStates.end(), J->DepStates.rbegin(), J->DepStates.rend());
+	 if (J == &Journal)
+	    break;
+      }
+
+      for (auto const &[ID, State] : PkgStates)
+      {
+	 if (not Innermost)
+	    cache.JournalPkgState(ID);
+	 cache.PkgState[ID] = State;
+      }
+      for (auto const &[ID, State] : DepStates)
+      {
+	 if (not Innermost)
+	    cache.JournalDepState(ID);
+	 cache.DepState[ID] = State;
+      }
+   }
+
+   ~Private()
+   {
+      // the enclosing transaction has to be able to undo our changes, too
+      auto const Parent = Journal.Parent;
+      if (Parent != nullptr)
+      {
+	 Parent->PkgStates.insert(Parent->PkgStates.end(), Journal.PkgStates.begin(), Journal.PkgStates.end());
+	 Parent->DepStates.insert(Parent->DepStates.end(), Journal.DepStates.begin(), Journal.DepStates.end());
+      }
+      if (cache.d->Undo == &Journal)
+	 cache.d->Undo = Parent;
+      else
+	 for (auto J = cache.d->Undo; J != nullptr; J = J->Parent)
+	    if (J->Parent == &Journal)
+	    {
+	       J->Parent = Parent;
+	       break;
+	    }
+   }
 };
 
-pkgDepCache::Transaction::Transaction(pkgDepCache &cache, Behavior behavior) : d(new Private{cache, behavior}) {}
+pkgDepCache::Transaction::Transaction(pkgDepCache &cache, Behavior behavior) : Transaction(cache, behavior, Undo::COPY) {}
+pkgDepCache::Transaction::Transaction(pkgDepCache &cache, Behavior behavior, Undo undo) : d(new Private{cache, behavior, undo}) {}
 
 void pkgDepCache::Transaction::temporaryRollback()
 {
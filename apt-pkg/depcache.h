@@ -273,6 +273,12 @@ class APT_PUBLIC pkgDepCache : protected pkgCache::Namespace
     * The default policy for a transaction is to rollback if the number of broken packages
     * increased, otherwise to commit. Call commit() or rollback() to override the default
     * policy.
+    *
+    * By default a transaction copies the states of all packages and dependencies when it
+    * is opened. A transaction opened with Undo::JOURNAL instead records their previous
+    * values as they are changed, so opening and closing it costs only as much as the
+    * changes made in it. The methods of the depcache record their changes, code changing
+    * states via operator[] has to call JournalPkgState() or JournalDepState() first.
     */
    class APT_PUBLIC Transaction final
    {
@@ -286,8 +292,14 @@ class APT_PUBLIC pkgDepCache : protected pkgCache::Namespace
 	 ROLLBACK,
 	 AUTO,
       };
+      enum class Undo
+      {
+	 COPY,
+	 JOURNAL,
+      };
 
       explicit Transaction(pkgDepCache &cache, Behavior behavior);
+      Transaction(pkgDepCache &cache, Behavior behavior, Undo undo);
       /** \brief Commit the transaction immediately */
       void commit();
       /** \brief Rollback the transaction immediately */
@@ -436,7 +448,7 @@ class APT_PUBLIC pkgDepCache : protected pkgCache::Namespace
    bool MarkInstall(PkgIterator const &Pkg,bool AutoInst = true,
 		    unsigned long Depth = 0, bool FromUser = true,
 		    bool ForceImportantDeps = false);
-   void MarkProtected(PkgIterator const &Pkg) { PkgState[Pkg->ID].iFlags |= Protected; };
+   void MarkProtected(PkgIterator const &Pkg);
 
    void SetReInstall(PkgIterator const &Pkg,bool To);
 
@@ -552,6 +564,23 @@ class APT_PUBLIC pkgDepCache : protected pkgCache::Namespace
    APT_HIDDEN bool MarkInstall_DiscardInstall(PkgIterator const &Pkg);
 
    APT_HIDDEN void PerformDependencyPass(OpProgress * const Prog);
+   APT_HIDDEN void UpdateDepStates(DepIterator D);
+   APT_HIDDEN void UpdateDepState(DepIterator const &D);
+   APT_HIDDEN void UpdateRevDepStates(PkgIterator const &Pkg);
+   APT_HIDDEN void UpdateDirtyVersions();
+
+   public:
+   /** \brief Remember a state before it is changed while a Transaction is open
+    *
+    *  The depcache records its own changes, code changing the states via
+    *  operator[] has to call these first to have them rolled back by a
+    *  transaction opened with Transaction::Undo::JOURNAL.
+    */
+   void JournalPkgState(map_id_t const ID);
+   void JournalDepState(map_id_t const ID);
+   APT_HIDDEN void JournalPkgState(map_id_t const ID, StateCache const &State);
+   /** \brief Set the flags computed by mark and sweep, e.g. by a solver */
+   APT_HIDDEN void SetMarkFlags(PkgIterator const &Pkg, bool const Marked, bool const Garbage);
 };
 
 #endif
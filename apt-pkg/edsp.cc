@@ -431,8 +431,7 @@ bool EDSP::ReadResponse(int const input, pkgDepCache &Cache, OpProgress *Progres
 	for (pkgCache::PkgIterator P = Cache.PkgBegin(); P.end() == false; ++P) {
 		for (pkgCache::VerIterator V = P.VersionList(); V.end() == false; ++V)
 			VerIdx[V->ID] = V.Index();
-		Cache[P].Marked = true;
-		Cache[P].Garbage = false;
+		Cache.SetMarkFlags(P, true, false);
 	}
 
 	FileFd in;
@@ -495,8 +494,7 @@ bool EDSP::ReadResponse(int const input, pkgDepCache &Cache, OpProgress *Progres
 		pkgCache::VerIterator Ver(Cache.GetCache(), Cache.GetCache().VerP + VerIdx[id]);
 		auto const Pkg = Ver.ParentPkg();
 		if (type == "Autoremove") {
-			Cache[Pkg].Marked = false;
-			Cache[Pkg].Garbage = true;
+			Cache.SetMarkFlags(Pkg, false, true);
 		} else if (seenOnce.emplace(Pkg->ID).second == false) {
 			_error->Warning("Ignoring %s stanza received for package %s which already had a previous stanza effecting it!", type.c_str(), Pkg.FullName(false).c_str());
 		} else if (type == "Install") {
@@ -43,8 +43,14 @@ bool pkgPackageManager::SigINTStop = false;
 // PM::PackageManager - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
+struct pkgPackageManager::Private
+{
+   bool WaitForMissing = false;
+   // the last ordering stopped at a missing archive before doing anything
+   bool NothingDone = false;
+};
 pkgPackageManager::pkgPackageManager(pkgDepCache *pCache) : Cache(*pCache),
-							    List(nullptr), Res(Incomplete), d(nullptr)
+							    List(nullptr), Res(Incomplete), d(new Private())
 {
    FileNames = std::make_unique<string[]>(Cache.Head().PackageCount);
    Debug = _config->FindB("Debug::pkgPackageManager",false);
@@ -55,7 +61,10 @@ pkgPackageManager::pkgPackageManager(pkgDepCache *pCache) : Cache(*pCache),
 // PM::PackageManager - Destructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgPackageManager::~pkgPackageManager() = default;
+pkgPackageManager::~pkgPackageManager()
+{
+   delete d;
+}
 									/*}}}*/
 // PM::GetArchives - Queue the archives for download			/*{{{*/
 // ---------------------------------------------------------------------
@@ -1037,6 +1046,7 @@ bool pkgPackageManager::SmartUnPack(PkgIterator Pkg, bool const Immediate, int c
 /* */
 pkgPackageManager::OrderResult pkgPackageManager::OrderInstall()
 {
+   d->NothingDone = false;
    if (CreateOrderList() == false)
       return Failed;
 
@@ -1087,6 +1097,11 @@ pkgPackageManager::OrderResult pkgPackageManager::OrderInstall()
 	    clog << "Sequence completed at " << Pkg.FullName() << endl;
 	 if (DoneSomething == false)
 	 {
+	    if (d->WaitForMissing)
+	    {
+	       d->NothingDone = true;
+	       return Incomplete;
+	    }
 	    _error->Error("Internal Error, ordering was unable to handle the media swap");
 	    return Failed;
 	 }	 
@@ -1143,6 +1158,8 @@ pkgPackageManager::OrderResult pkgPackageManager::OrderInstall()
 pkgPackageManager::OrderResult 
 pkgPackageManager::DoInstallPostFork(APT::Progress::PackageManager *progress)
 {
+   if (d->NothingDone)
+      return Res;
    bool goResult;
    goResult = Go(progress);
    if(goResult == false) 
@@ -1151,6 +1168,12 @@ pkgPackageManager::DoInstallPostFork(APT::Progress::PackageManager *progress)
    return Res;
 }
 									/*}}}*/	
+// PM::SetWaitForMissing - Wait for archives still being downloaded	/*{{{*/
+void pkgPackageManager::SetWaitForMissing(bool const Wait)
+{
+   d->WaitForMissing = Wait;
+}
+									/*}}}*/
 // PM::DoInstall - Does the installation				/*{{{*/
 // ---------------------------------------------------------------------
 /* This uses the filenames in FileNames and the information in the
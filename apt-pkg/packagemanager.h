@@ -122,6 +122,14 @@ class APT_PUBLIC pkgPackageManager : protected pkgCache::Namespace
    // ?
    bool FixMissing();
 
+   /** \brief Do not fail if the first package to unpack is missing
+
+       Normally a missing archive is only expected after some packages were
+       unpacked, e.g. while swapping media. If archives are still being
+       downloaded while installing, none of them might be there yet: with
+       this set DoInstall returns Incomplete without running anything. */
+   void SetWaitForMissing(bool const Wait);
+
    /** \brief returns all packages dpkg let disappear */
    inline std::set<std::string> GetDisappearedPackages() { return disappearedPkgs; };
 
@@ -129,7 +137,8 @@ class APT_PUBLIC pkgPackageManager : protected pkgCache::Namespace
    virtual ~pkgPackageManager();
 
    private:
-   void * const d;
+   struct Private;
+   Private * const d;
    enum APT_HIDDEN SmartAction { UNPACK_IMMEDIATE, UNPACK, CONFIGURE };
    [[nodiscard]] APT_HIDDEN bool NonLoopingSmart(SmartAction action, pkgCache::PkgIterator &Pkg,
 						 pkgCache::PkgIterator DepPkg, int Depth, bool PkgLoop,
@@ -24,6 +24,7 @@
 #include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
 #include <apt-pkg/macros.h>
 #include <apt-pkg/mmap.h>
 #include <apt-pkg/pkgcache.h>
@@ -35,8 +36,11 @@
 #include <array>
 #include <cstddef>
 #include <cstring>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <sys/stat.h>
 #include <xxhash.h>
@@ -58,7 +62,7 @@ pkgCache::Header::Header()
 
    /* Whenever the structures change the major version should be bumped,
       whenever the generator changes the minor version should be bumped. */
-   APT_HEADER_SET(MajorVersion, 16);
+   APT_HEADER_SET(MajorVersion, 20);
    APT_HEADER_SET(MinorVersion, 0);
    APT_HEADER_SET(Dirty, false);
 
@@ -99,8 +103,19 @@ pkgCache::Header::Header()
    SetArchitectures(0);
    SetHashTableSize(_config->FindI("APT::Cache-HashTableSize", 196613));
    memset(Pools,0,sizeof(Pools));
+   GrpIndex = 0;
+   GrpIndexSize = 0;
+   VerRank = 0;
+   DepRank = 0;
+   RevDepends = 0;
+   RevProvides = 0;
 
    CacheFileSize = 0;
+   HeaderHash = 0;
+   FileInode = 0;
+   FileSize = 0;
+   FileModificationTime = 0;
+   FileModificationTimeNsec = 0;
 }
 									/*}}}*/
 // Cache::Header::CheckSizes - Check if the two headers have same *sz	/*{{{*/
@@ -129,7 +144,14 @@ bool pkgCache::Header::CheckSizes(Header &Against) const
 // Cache::pkgCache - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(NULL)
+struct pkgCache::Private
+{
+   /* Results of CheckProvideDep by dependency ID and index of the provides.
+      The parallel mark phase of the autoremover checks provides, too. */
+   std::shared_mutex ProvideDepsLock;
+   std::unordered_map<uint64_t, bool> ProvideDeps;
+};
+pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(new Private())
 {
    // call getArchitectures() with cached=false to ensure that the
    // architectures cache is re-evaluated. this is needed in cases
@@ -144,6 +166,13 @@ pkgCache::pkgCache(MMap *Map, bool DoMap) : Map(*Map), VS(nullptr), d(NULL)
 // ---------------------------------------------------------------------
 /* If the file is already closed then this will open it open it. */
 bool pkgCache::ReMap(bool const &Errorchecks)
+{
+   return ReMap(Errorchecks, nullptr);
+}
+/* If the cache is mapped from File and it is still unchanged since it was
+   written, only the header and the hash tables are verified rather than
+   hashing (and so reading) the complete file. */
+bool pkgCache::ReMap(bool const &Errorchecks, FileFd * const File)
 {
    // Apply the typecasts.
    HeaderP = (Header *)Map.Data();
@@ -160,6 +189,18 @@ bool pkgCache::ReMap(bool const &Errorchecks)
    DepP = (Dependency *)Map.Data();
    DepDataP = (DependencyData *)Map.Data();
    StrP = (char *)Map.Data();
+   // both rank arrays are built and invalidated together
+   bool const HasRanks = HeaderP != nullptr && Map.Size() >= sizeof(Header) && HeaderP->VerRank != 0 && HeaderP->DepRank != 0;
+   VerRankP = HasRanks ? (map_id_t *)Map.Data() + HeaderP->VerRank : nullptr;
+   DepRankP = HasRanks ? (map_id_t *)Map.Data() + HeaderP->DepRank : nullptr;
+   RevDependsP = (HeaderP == nullptr || Map.Size() < sizeof(Header) || HeaderP->RevDepends == 0) ? nullptr : (map_id_t *)Map.Data() + HeaderP->RevDepends;
+   RevProvidesP = (RevDependsP == nullptr || HeaderP->RevProvides == 0) ? nullptr : (map_id_t *)Map.Data() + HeaderP->RevProvides;
+   if (RevProvidesP == nullptr)
+      RevDependsP = nullptr;
+   {
+      std::unique_lock<std::shared_mutex> Guard(d->ProvideDepsLock);
+      d->ProvideDeps.clear();
+   }
 
    if (Errorchecks == false)
       return true;
@@ -198,6 +239,42 @@ bool pkgCache::ReMap(bool const &Errorchecks)
       return _error->Error(_("The package cache was built for different architectures: %s vs %s"), StrP + HeaderP->GetArchitectures(), list.c_str());
 
 
+   if (HeaderP->GrpIndex != 0 &&
+       ((HeaderP->GrpIndexSize & (HeaderP->GrpIndexSize - 1)) != 0 ||
+	(static_cast<unsigned long long>(uint32_t(HeaderP->GrpIndex)) + HeaderP->GrpIndexSize) * sizeof(GroupIndexSlot) > Map.Size()))
+      return _error->Error(_("The package cache file is corrupted"));
+   if (HeaderP->DepRank != 0 &&
+       (static_cast<unsigned long long>(uint32_t(HeaderP->DepRank)) + HeaderP->DependsCount) * sizeof(map_id_t) > Map.Size())
+      return _error->Error(_("The package cache file is corrupted"));
+   if (HeaderP->VerRank != 0 &&
+       (static_cast<unsigned long long>(uint32_t(HeaderP->VerRank)) + HeaderP->VersionCount) * sizeof(map_id_t) > Map.Size())
+      return _error->Error(_("The package cache file is corrupted"));
+   auto const ReverseIndexFits = [&](map_pointer<map_id_t> Index) {
+      auto const Offsets = static_cast<unsigned long long>(uint32_t(Index)) + HeaderP->PackageCount + 1;
+      return Offsets * sizeof(map_id_t) <= Map.Size() &&
+	     (Offsets + ((map_id_t *)Map.Data() + Index)[HeaderP->PackageCount]) * sizeof(map_id_t) <= Map.Size();
+   };
+   if (RevDependsP != nullptr &&
+       (ReverseIndexFits(HeaderP->RevDepends) == false || ReverseIndexFits(HeaderP->RevProvides) == false))
+      return _error->Error(_("The package cache file is corrupted"));
+
+   if (File != nullptr && HeaderP->FileInode != 0 && HeaderP->FileSize == Map.Size() &&
+       _config->FindB("APT::Cache-TrustUnchanged", true))
+   {
+      struct stat St;
+      if (fstat(File->Fd(), &St) == 0 && static_cast<uint64_t>(St.st_ino) == HeaderP->FileInode &&
+	  static_cast<uint64_t>(St.st_size) == HeaderP->FileSize && St.st_mtim.tv_sec == HeaderP->FileModificationTime &&
+	  St.st_mtim.tv_nsec == HeaderP->FileModificationTimeNsec)
+      {
+	 auto const hash = HeaderHash();
+	 if (_config->FindB("Debug::pkgCacheGen", false))
+	    std::clog << "Opened unchanged cache with header hash " << hash << ", expecting " << HeaderP->HeaderHash << "\n";
+	 if (hash != HeaderP->HeaderHash)
+	    return _error->Error(_("The package cache file is corrupted, it has the wrong hash"));
+	 return true;
+      }
+   }
+
    auto hash = CacheHash();
    if (_config->FindB("Debug::pkgCacheGen", false))
       std::clog << "Opened cache with hash " << hash << ", expecting " <<  HeaderP->CacheFileSize << "\n";
@@ -233,6 +310,12 @@ map_id_t pkgCache::sHash(string_view Str) const
       Hash = 33u * Hash + tolower_ascii_unsafe(*I);
    return Hash % HeaderP->GetHashTableSize();
 }
+// Cache::IndexHash - Hash a string for the index of the groups	/*{{{*/
+uint32_t pkgCache::IndexHash(string_view Str)
+{
+   return XXH3_64bits(Str.data(), Str.length()) & 0xFFFFFFFF;
+}
+									/*}}}*/
 uint32_t pkgCache::CacheHash()
 {
    pkgCache::Header header = {};
@@ -261,6 +344,51 @@ uint32_t pkgCache::CacheHash()
 			 GetMap().Size() - sizeof(header));
    }
 
+   auto const digest = XXH3_64bits_digest(state);
+   XXH3_freeState(state);
+   return digest & 0xFFFFFFFF;
+}
+/* Only covers the header, the hash tables behind it and the index of the
+   groups, which are needed to find anything in the cache at all. */
+uint32_t pkgCache::HeaderHash()
+{
+   pkgCache::Header header = {};
+
+   if (Map.Size() < sizeof(header))
+      return 0;
+
+   memcpy(&header, GetMap().Data(), sizeof(header));
+   auto const TablesSize = static_cast<unsigned long long>(header.GetHashTableSize()) *
+			   (sizeof(map_pointer<Group>) + sizeof(map_pointer<Package>));
+   if (Map.Size() - sizeof(header) < TablesSize)
+      return 0;
+
+   header.Dirty = false;
+   header.CacheFileSize = 0;
+   header.HeaderHash = 0;
+
+   XXH3_state_t *state = XXH3_createState();
+   XXH3_64bits_reset(state);
+
+   XXH3_64bits_update(state,
+		      reinterpret_cast<const unsigned char *>(PACKAGE_VERSION),
+		      strlen(PACKAGE_VERSION));
+
+   XXH3_64bits_update(state,
+		      reinterpret_cast<const unsigned char *>(&header),
+		      sizeof(header));
+
+   XXH3_64bits_update(state,
+		      static_cast<const unsigned char *>(GetMap().Data()) + sizeof(header),
+		      TablesSize);
+
+   auto const IndexSize = static_cast<unsigned long long>(header.GrpIndexSize) * sizeof(GroupIndexSlot);
+   auto const IndexStart = static_cast<unsigned long long>(uint32_t(header.GrpIndex)) * sizeof(GroupIndexSlot);
+   if (header.GrpIndex != 0 && IndexStart + IndexSize <= Map.Size())
+      XXH3_64bits_update(state,
+			 static_cast<const unsigned char *>(GetMap().Data()) + IndexStart,
+			 IndexSize);
+
    auto const digest = XXH3_64bits_digest(state);
    XXH3_freeState(state);
    return digest & 0xFFFFFFFF;
@@ -303,6 +431,9 @@ pkgCache::GrpIterator pkgCache::FindGrp(string_view Name) {
 	if (unlikely(Name.empty() == true))
 		return GrpIterator(*this,0);
 
+	if (HeaderP->GrpIndex != 0)
+		return FindGrpInIndex(Name);
+
 	// Look at the hash bucket for the group
 	Group *Grp = GrpP + HeaderP->GrpHashTableP()[sHash(Name)];
 	for (; Grp != GrpP; Grp = GrpP + Grp->Next) {
@@ -316,6 +447,24 @@ pkgCache::GrpIterator pkgCache::FindGrp(string_view Name) {
 	return GrpIterator(*this,0);
 }
 									/*}}}*/
+// Cache::FindGrpInIndex - Locate a group in the index by name		/*{{{*/
+pkgCache::GrpIterator pkgCache::FindGrpInIndex(string_view Name)
+{
+   uint32_t const Hash = IndexHash(Name);
+   uint32_t const Mask = HeaderP->GrpIndexSize - 1;
+   GroupIndexSlot const * const Index = HeaderP->GrpIndexP();
+   for (uint32_t Distance = 0; Distance <= Mask; ++Distance)
+   {
+      GroupIndexSlot const &Slot = Index[(Hash + Distance) & Mask];
+      if (Slot.Group == 0 || ((((Hash + Distance) & Mask) - Slot.Hash) & Mask) < Distance)
+	 break;
+      if (Slot.Hash == Hash && Slot.NameLength == Name.length() &&
+	  memcmp(StrP + Slot.Name, Name.data(), Name.length()) == 0)
+	 return GrpIterator(*this, GrpP + Slot.Group);
+   }
+   return GrpIterator(*this,0);
+}
+									/*}}}*/
 // Cache::CompTypeDeb - Return a string describing the compare type	/*{{{*/
 // ---------------------------------------------------------------------
 /* This returns a string representation of the dependency compare
@@ -789,10 +938,33 @@ bool pkgCache::DepIterator::IsSatisfied(PkgIterator const &Pkg) const
 }
 bool pkgCache::DepIterator::IsSatisfied(VerIterator const &Ver) const
 {
+   if (Owner->VerRankP != nullptr && S != Owner->DepP)
+   {
+      // same as CheckDep, but comparing the ranks of the versions
+      map_id_t const DepRank = Owner->DepRankP[S->ID];
+      map_id_t const PkgRank = Owner->VerRankP[Ver->ID];
+      if (DepRank == 0)
+	 return true;
+      if (PkgRank == 0)
+	 return false;
+      switch (S2->CompareOp & 0x0F)
+      {
+	 case Dep::LessEq: return PkgRank <= DepRank;
+	 case Dep::GreaterEq: return PkgRank >= DepRank;
+	 case Dep::Less: return PkgRank < DepRank;
+	 case Dep::Greater: return PkgRank > DepRank;
+	 case Dep::Equals: return PkgRank == DepRank;
+	 case Dep::NotEquals: return PkgRank != DepRank;
+      }
+      return false;
+   }
    return Owner->VS->CheckDep(Ver.VerStr(),S2->CompareOp,TargetVer());
 }
 bool pkgCache::DepIterator::IsSatisfied(PrvIterator const &Prv) const
 {
+   // only the complete cache stays unchanged long enough to remember results
+   if (Owner->VerRankP != nullptr && S2->Version != 0 && Prv->ProvideVersion != 0)
+      return Owner->CheckProvideDep(*this, Prv);
    return Owner->VS->CheckDep(Prv.ProvideVersion(),S2->CompareOp,TargetVer());
 }
 									/*}}}*/
@@ -836,6 +1008,57 @@ APT_IGNORE_DEPRECATED_POP
    return out;
 }
 									/*}}}*/
+// Cache::CmpVersion - Compare two versions of the cache			/*{{{*/
+int pkgCache::CmpVersion(VerIterator const &A, VerIterator const &B) const
+{
+   if (VerRankP != nullptr)
+   {
+      map_id_t const RankA = VerRankP[A->ID];
+      map_id_t const RankB = VerRankP[B->ID];
+      if (RankA != 0 && RankB != 0)
+	 return RankA < RankB ? -1 : (RankA > RankB ? 1 : 0);
+   }
+   return VS->CmpVersion(A.VerStr(), B.VerStr());
+}
+									/*}}}*/
+// Cache::CheckProvideDep - Check a versioned provides, remembering it	/*{{{*/
+// ---------------------------------------------------------------------
+/* Versions of provides have no rank, so the versioning system has to
+   compare the strings. The resolvers check the same dependencies over and
+   over again, so the results are kept until the cache is mapped again. */
+bool pkgCache::CheckProvideDep(DepIterator const &Dep, PrvIterator const &Prv)
+{
+   uint64_t const Key = (static_cast<uint64_t>(Dep->ID) << 32) | Prv.Index();
+   {
+      std::shared_lock<std::shared_mutex> Guard(d->ProvideDepsLock);
+      auto const Found = d->ProvideDeps.find(Key);
+      if (Found != d->ProvideDeps.end())
+	 return Found->second;
+   }
+   bool const Result = VS->CheckDep(Prv.ProvideVersion(), Dep->CompareOp, Dep.TargetVer());
+   std::unique_lock<std::shared_mutex> Guard(d->ProvideDepsLock);
+   d->ProvideDeps.emplace(Key, Result);
+   return Result;
+}
+									/*}}}*/
+// Cache::RevDepends - Reverse dependencies of a package from the index	/*{{{*/
+pkgCache::IndexRange<map_pointer<pkgCache::Dependency>> pkgCache::RevDepends(PkgIterator const &Pkg) const
+{
+   if (RevDependsP == nullptr)
+      return {};
+   auto const Entries = reinterpret_cast<map_pointer<Dependency> const *>(RevDependsP + HeaderP->PackageCount + 1);
+   return {Entries + RevDependsP[Pkg->ID], Entries + RevDependsP[Pkg->ID + 1]};
+}
+									/*}}}*/
+// Cache::RevProvides - Provides of a package from the index		/*{{{*/
+pkgCache::IndexRange<map_pointer<pkgCache::Provides>> pkgCache::RevProvides(PkgIterator const &Pkg) const
+{
+   if (RevProvidesP == nullptr)
+      return {};
+   auto const Entries = reinterpret_cast<map_pointer<Provides> const *>(RevProvidesP + HeaderP->PackageCount + 1);
+   return {Entries + RevProvidesP[Pkg->ID], Entries + RevProvidesP[Pkg->ID + 1]};
+}
+									/*}}}*/
 // VerIterator::CompareVer - Fast version compare for same pkgs		/*{{{*/
 // ---------------------------------------------------------------------
 /* This just looks over the version list to see if B is listed before A. In
@@ -1075,4 +1298,4 @@ bool pkgCache::VerIterator::IsSecurityUpdate() const
 }
 
 									/*}}}*/
-pkgCache::~pkgCache() {}
+pkgCache::~pkgCache() { delete d; }
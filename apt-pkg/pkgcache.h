@@ -121,6 +121,7 @@ typedef map_pointer<char> map_stringitem_t;
 typedef uint8_t map_flags_t;
 typedef uint8_t map_number_t;
 
+class FileFd;
 class pkgVersioningSystem;
 class APT_PUBLIC pkgCache								/*{{{*/
 {
@@ -140,6 +141,7 @@ class APT_PUBLIC pkgCache								/*{{{*/
    struct StringItem;
    struct VerFile;
    struct DescFile;
+   struct GroupIndexSlot;
    
    // Iterators
    template<typename Str, typename Itr> class Iterator;
@@ -216,6 +218,7 @@ class APT_PUBLIC pkgCache								/*{{{*/
    std::string CacheFile;
    MMap &Map;
    map_id_t sHash(std::string_view S) const APT_PURE;
+   APT_HIDDEN GrpIterator FindGrpInIndex(std::string_view Name);
    
    public:
    
@@ -234,9 +237,14 @@ class APT_PUBLIC pkgCache								/*{{{*/
    Dependency *DepP;
    DependencyData *DepDataP;
    char *StrP;
-   void *reserved[13];
+   map_id_t *VerRankP; // nullptr if the cache has none, see Header::VerRank
+   map_id_t *DepRankP; // nullptr if the cache has none, see Header::VerRank
+   map_id_t *RevDependsP; // nullptr if the cache has none, see Header::RevDepends
+   map_id_t *RevProvidesP; // nullptr if the cache has none, see Header::RevDepends
+   void *reserved[9];
 
    virtual bool ReMap(bool const &Errorchecks = true);
+   APT_HIDDEN bool ReMap(bool const &Errorchecks, FileFd * const File);
    inline bool Sync() {return Map.Sync();}
    inline MMap &GetMap() {return Map;}
    inline void *DataEnd() {return ((unsigned char *)Map.Data()) + Map.Size();}
@@ -245,6 +253,8 @@ class APT_PUBLIC pkgCache								/*{{{*/
    inline map_id_t Hash(std::string_view S) const {return sHash(S);}
 
    APT_HIDDEN uint32_t CacheHash();
+   APT_HIDDEN uint32_t HeaderHash();
+   APT_HIDDEN static uint32_t IndexHash(std::string_view S) APT_PURE;
 
    // Useful transformation things
    static const char *Priority(unsigned char Priority);
@@ -277,6 +287,24 @@ class APT_PUBLIC pkgCache								/*{{{*/
 
    // Make me a function
    pkgVersioningSystem *VS;
+   // compares versions by their ranks if the cache has them, see Header::VerRank
+   APT_HIDDEN int CmpVersion(VerIterator const &A, VerIterator const &B) const;
+   // checks a versioned dependency against a versioned provides, remembering the result
+   APT_HIDDEN bool CheckProvideDep(DepIterator const &Dep, PrvIterator const &Prv);
+   // reverse dependencies and provides of a package in the order of their
+   // lists as contiguous arrays, only if the cache has them, see Header::RevDepends
+   template <typename T>
+   struct IndexRange
+   {
+      T const *Begin = nullptr;
+      T const *End = nullptr;
+      T const *begin() const { return Begin; }
+      T const *end() const { return End; }
+      bool empty() const { return Begin == End; }
+   };
+   inline bool HasReverseIndex() const { return RevDependsP != nullptr; }
+   IndexRange<map_pointer<Dependency>> RevDepends(PkgIterator const &Pkg) const;
+   IndexRange<map_pointer<Provides>> RevProvides(PkgIterator const &Pkg) const;
    
    // Converters
    static const char *CompTypeDeb(unsigned char Comp) APT_PURE;
@@ -288,7 +316,8 @@ class APT_PUBLIC pkgCache								/*{{{*/
    virtual ~pkgCache();
 
 private:
-   void * const d;
+   struct Private;
+   Private * const d;
    bool MultiArchEnabled;
 };
 									/*}}}*/
@@ -395,18 +424,80 @@ struct pkgCache::Header
    map_stringitem_t GetArchitectures() const { return Architectures; }
    void SetArchitectures(map_stringitem_t const idx) { Architectures = idx; }
 
+   /** \brief open addressing index of the groups by name
+
+       Unlike the hash tables above it is sized for the amount of groups in
+       the cache, so it can only be built once the cache is complete. GrpIndex
+       is 0 if the cache has been changed since, lookups use the hash tables
+       then. GrpIndexSize is the number of slots, always a power of two. */
+   map_pointer<GroupIndexSlot> GrpIndex;
+   uint32_t GrpIndexSize;
+
+   /** \brief rank of each version in the order of the versioning system
+
+       Indexed by the ID of the version, versions comparing equal have the
+       same rank, 0 is used for an empty version string. DepRank holds the
+       ranks of the versions in the dependencies by their ID, 0 for an
+       unversioned dependency. Like GrpIndex both are only built once the
+       cache is complete and 0 if the cache has been changed since. */
+   map_pointer<map_id_t> VerRank;
+   map_pointer<map_id_t> DepRank;
+
+   /** \brief reverse dependencies and provides of the packages by their ID
+
+       Both start with PackageCount + 1 offsets followed by the indexes of
+       the dependencies respectively provides in the order of the lists of
+       the packages, those of the package with ID i are the entries from
+       offset i to offset i + 1. Like GrpIndex only built once the cache is
+       complete and 0 if the cache has been changed since or if disabled
+       with APT::Cache-ReverseIndex. */
+   map_pointer<map_id_t> RevDepends;
+   map_pointer<map_id_t> RevProvides;
+
 #ifdef APT_COMPILING_APT
    map_pointer<Group> * GrpHashTableP() const { return (map_pointer<Group>*) (this + 1); }
    map_pointer<Package> * PkgHashTableP() const { return reinterpret_cast<map_pointer<Package> *>(GrpHashTableP() + GetHashTableSize()); }
+   GroupIndexSlot * GrpIndexP() const { return reinterpret_cast<GroupIndexSlot *>(const_cast<Header *>(this)) + GrpIndex; }
 #endif
 
    /** \brief Hash of the file (TODO: Rename) */
    map_filesize_small_t CacheFileSize;
+   /** \brief Hash of the header and the hash tables */
+   uint32_t HeaderHash;
+
+   /** \brief Identity of the file the cache was written to
+
+       As long as the file still has the inode, size and modification time
+       it was written with, nobody has modified it since. Opening it then
+       only verifies the header and the hash tables instead of hashing
+       the complete file. An inode of 0 means the identity is unknown.
+       The nanoseconds of the modification time are never 0, so on file
+       systems storing whole seconds only the identity never matches. */
+   uint64_t FileInode;
+   uint64_t FileSize;
+   int64_t FileModificationTime;
+   int64_t FileModificationTimeNsec;
 
    bool CheckSizes(Header &Against) const APT_PURE;
    Header();
 };
 									/*}}}*/
+// GroupIndexSlot structure						/*{{{*/
+/** \brief a slot of the open addressing index of the groups
+
+    The slots are placed with robin hood hashing on the lower bits of the
+    hash, so a lookup can stop as soon as it meets a slot which is closer
+    to its own place than the name looked for would be. Comparing the hash
+    and the length first means usually only the name of the group which is
+    looked for is read from the cache. An empty slot has no Group. */
+struct pkgCache::GroupIndexSlot
+{
+   uint32_t Hash;
+   uint32_t NameLength;
+   map_stringitem_t Name;
+   map_pointer<pkgCache::Group> Group;
+};
+									/*}}}*/
 // Group structure							/*{{{*/
 /** \brief groups architecture depending packages together
 
@@ -30,8 +30,10 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <vector>
 #include <sys/stat.h>
@@ -136,6 +138,7 @@ bool pkgCacheGenerator::Start()
    }
 
    Cache.HeaderP->Dirty = true;
+   Cache.HeaderP->FileInode = 0;
    Map.Sync(0,sizeof(pkgCache::Header));
    return true;
 }
@@ -614,11 +617,199 @@ bool pkgCacheGenerator::NewGroup(pkgCache::GrpIterator &Grp, string_view Name)
       insertAt = &(Cache.GrpP + *insertAt)->Next;
    Grp->Next = *insertAt;
    *insertAt = Group;
+   Cache.HeaderP->GrpIndex = 0;
 
    Grp->ID = Cache.HeaderP->GroupCount++;
    return true;
 }
 									/*}}}*/
+// CacheGenerator::Finish - Build the tables of a complete cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* These tables are sized for the rest of the cache, so they
+   are built once the cache is complete rather than maintained while it is
+   generated. Changing the cache afterwards invalidates them. */
+bool pkgCacheGenerator::Finish()
+{
+   return BuildGroupIndex() && BuildVersionRanks() && BuildReverseIndex();
+}
+									/*}}}*/
+// CacheGenerator::BuildGroupIndex - Index the groups by name		/*{{{*/
+bool pkgCacheGenerator::BuildGroupIndex()
+{
+   if (Cache.HeaderP->GrpIndex != 0)
+      return true;
+
+   // keep the load factor at most 3/4, robin hood hashing copes well with that
+   uint32_t Size = 16;
+   while (Size * 3ull < Cache.HeaderP->GroupCount * 4ull)
+      Size *= 2;
+
+   size_t oldSize = Map.Size();
+   void const * const oldMap = Map.Data();
+   auto const Offset = Map.RawAllocate(Size * sizeof(pkgCache::GroupIndexSlot), 64);
+   if (Offset == 0)
+      return false;
+   ReMap(oldMap, Map.Data(), oldSize);
+
+   auto const Index = static_cast<pkgCache::GroupIndexSlot *>(Map.Data()) + Offset / sizeof(pkgCache::GroupIndexSlot);
+   std::fill_n(Index, Size, pkgCache::GroupIndexSlot{});
+   uint32_t const Mask = Size - 1;
+   for (auto G = Cache.GrpBegin(); G.end() == false; ++G)
+   {
+      auto const Name = Cache.ViewString(G->Name);
+      pkgCache::GroupIndexSlot Slot{pkgCache::IndexHash(Name), static_cast<uint32_t>(Name.length()), G->Name, G.MapPointer()};
+      for (uint32_t Pos = Slot.Hash & Mask, Distance = 0;; Pos = (Pos + 1) & Mask, ++Distance)
+      {
+	 if (Index[Pos].Group == 0)
+	 {
+	    Index[Pos] = Slot;
+	    break;
+	 }
+	 // the poorer entry takes the slot and the richer one moves on
+	 uint32_t const Other = (Pos - Index[Pos].Hash) & Mask;
+	 if (Other < Distance)
+	 {
+	    std::swap(Slot, Index[Pos]);
+	    Distance = Other;
+	 }
+      }
+   }
+
+   Cache.HeaderP->GrpIndex = map_pointer<pkgCache::GroupIndexSlot>{static_cast<uint32_t>(Offset / sizeof(pkgCache::GroupIndexSlot))};
+   Cache.HeaderP->GrpIndexSize = Size;
+   return true;
+}
+									/*}}}*/
+// CacheGenerator::BuildVersionRanks - Order the version strings	/*{{{*/
+// ---------------------------------------------------------------------
+/* Every distinct version string of a version or a versioned dependency
+   gets a rank by the order of the versioning system, so that comparing
+   versions later on is comparing two integers. Equal versions like 1.0
+   and 1.00 share a rank. */
+bool pkgCacheGenerator::BuildVersionRanks()
+{
+   if (Cache.HeaderP->VerRank != 0 || Cache.VS == nullptr)
+      return true;
+
+   std::vector<map_stringitem_t> Strings;
+   Strings.reserve(Cache.HeaderP->VersionCount + Cache.HeaderP->DependsDataCount);
+   for (auto P = Cache.PkgBegin(); P.end() == false; ++P)
+      for (auto V = P.VersionList(); V.end() == false; ++V)
+      {
+	 Strings.push_back(V->VerStr);
+	 for (auto D = V.DependsList(); D.end() == false; ++D)
+	    if (D->Version != 0)
+	       Strings.push_back(D->Version);
+      }
+   std::sort(Strings.begin(), Strings.end());
+   Strings.erase(std::unique(Strings.begin(), Strings.end()), Strings.end());
+   Strings.erase(std::remove_if(Strings.begin(), Strings.end(), [&](map_stringitem_t const S) {
+		    return S == 0 || *(Cache.StrP + S) == '\0';
+		 }), Strings.end());
+
+   auto const VS = Cache.VS;
+   std::vector<map_stringitem_t> Ordered(Strings);
+   std::sort(Ordered.begin(), Ordered.end(), [&](map_stringitem_t const A, map_stringitem_t const B) {
+      return VS->CmpVersion(Cache.StrP + A, Cache.StrP + B) < 0;
+   });
+   std::vector<map_id_t> Ranks(Strings.size());
+   map_id_t Rank = 0;
+   for (size_t I = 0; I < Ordered.size(); ++I)
+   {
+      if (I == 0 || VS->CmpVersion(Cache.StrP + Ordered[I - 1], Cache.StrP + Ordered[I]) != 0)
+	 ++Rank;
+      Ranks[std::lower_bound(Strings.begin(), Strings.end(), Ordered[I]) - Strings.begin()] = Rank;
+   }
+   auto const RankOf = [&](map_stringitem_t const S) -> map_id_t {
+      auto const I = std::lower_bound(Strings.begin(), Strings.end(), S);
+      if (I == Strings.end() || *I != S)
+	 return 0;
+      return Ranks[I - Strings.begin()];
+   };
+
+   size_t oldSize = Map.Size();
+   void const * const oldMap = Map.Data();
+   auto const VerCount = Cache.HeaderP->VersionCount;
+   auto const DepCount = Cache.HeaderP->DependsCount;
+   auto const VerOffset = Map.RawAllocate(std::max<unsigned long long>(1, VerCount) * sizeof(map_id_t), 64);
+   auto const DepOffset = VerOffset == 0 ? 0 : Map.RawAllocate(std::max<unsigned long long>(1, DepCount) * sizeof(map_id_t), 64);
+   if (DepOffset == 0)
+      return false;
+   ReMap(oldMap, Map.Data(), oldSize);
+
+   auto const VerRank = static_cast<map_id_t *>(Map.Data()) + VerOffset / sizeof(map_id_t);
+   auto const DepRank = static_cast<map_id_t *>(Map.Data()) + DepOffset / sizeof(map_id_t);
+   std::fill_n(VerRank, VerCount, 0);
+   std::fill_n(DepRank, DepCount, 0);
+   for (auto P = Cache.PkgBegin(); P.end() == false; ++P)
+      for (auto V = P.VersionList(); V.end() == false; ++V)
+      {
+	 VerRank[V->ID] = RankOf(V->VerStr);
+	 for (auto D = V.DependsList(); D.end() == false; ++D)
+	    DepRank[D->ID] = RankOf(D->Version);
+      }
+
+   Cache.HeaderP->VerRank = map_pointer<map_id_t>{static_cast<uint32_t>(VerOffset / sizeof(map_id_t))};
+   Cache.HeaderP->DepRank = map_pointer<map_id_t>{static_cast<uint32_t>(DepOffset / sizeof(map_id_t))};
+   Cache.VerRankP = VerRank;
+   Cache.DepRankP = DepRank;
+   return true;
+}
+									/*}}}*/
+// CacheGenerator::BuildReverseIndex - Store the reverse lists as arrays	/*{{{*/
+// ---------------------------------------------------------------------
+/* The reverse dependencies and provides of a package are linked lists
+   spread all over the cache. Copying them into one array each per package
+   lets the resolvers and rdepends scan them instead. */
+bool pkgCacheGenerator::BuildReverseIndex()
+{
+   if (Cache.HeaderP->RevDepends != 0 || _config->FindB("APT::Cache-ReverseIndex", true) == false)
+      return true;
+
+   auto const PkgCount = Cache.HeaderP->PackageCount;
+   std::vector<map_id_t> DepOffsets(PkgCount + 1, 0);
+   std::vector<map_id_t> PrvOffsets(PkgCount + 1, 0);
+   for (auto P = Cache.PkgBegin(); P.end() == false; ++P)
+   {
+      for (auto D = P.RevDependsList(); D.end() == false; ++D)
+	 ++DepOffsets[P->ID + 1];
+      for (auto Prv = P.ProvidesList(); Prv.end() == false; ++Prv)
+	 ++PrvOffsets[P->ID + 1];
+   }
+   std::partial_sum(DepOffsets.begin(), DepOffsets.end(), DepOffsets.begin());
+   std::partial_sum(PrvOffsets.begin(), PrvOffsets.end(), PrvOffsets.begin());
+
+   size_t oldSize = Map.Size();
+   void const * const oldMap = Map.Data();
+   auto const DepStart = Map.RawAllocate((PkgCount + 1ull + DepOffsets.back()) * sizeof(map_id_t), 64);
+   if (DepStart == 0)
+      return false;
+   auto const PrvStart = Map.RawAllocate((PkgCount + 1ull + PrvOffsets.back()) * sizeof(map_id_t), 64);
+   if (PrvStart == 0)
+      return false;
+   ReMap(oldMap, Map.Data(), oldSize);
+
+   auto const RevDepends = static_cast<map_id_t *>(Map.Data()) + DepStart / sizeof(map_id_t);
+   auto const RevProvides = static_cast<map_id_t *>(Map.Data()) + PrvStart / sizeof(map_id_t);
+   std::copy(DepOffsets.begin(), DepOffsets.end(), RevDepends);
+   std::copy(PrvOffsets.begin(), PrvOffsets.end(), RevProvides);
+   for (auto P = Cache.PkgBegin(); P.end() == false; ++P)
+   {
+      auto Dep = RevDepends + PkgCount + 1 + DepOffsets[P->ID];
+      for (auto D = P.RevDependsList(); D.end() == false; ++D)
+	 *Dep++ = D.Index();
+      auto Prv = RevProvides + PkgCount + 1 + PrvOffsets[P->ID];
+      for (auto PI = P.ProvidesList(); PI.end() == false; ++PI)
+	 *Prv++ = PI.Index();
+   }
+
+   Cache.HeaderP->RevDepends = map_pointer<map_id_t>{static_cast<uint32_t>(DepStart / sizeof(map_id_t))};
+   Cache.HeaderP->RevProvides = map_pointer<map_id_t>{static_cast<uint32_t>(PrvStart / sizeof(map_id_t))};
+   Cache.RevDependsP = RevDepends;
+   Cache.RevProvidesP = RevProvides;
+   return true;
+}
+									/*}}}*/
 // CacheGenerator::NewPackage - Add a new package			/*{{{*/
 // ---------------------------------------------------------------------
 /* This creates a new package structure and adds it to the hash table */
@@ -649,6 +840,10 @@ bool pkgCacheGenerator::NewPackage(pkgCache::PkgIterator &Pkg, string_view Name,
       return false;
    Pkg->Arch = idxArch;
    Pkg->ID = Cache.HeaderP->PackageCount++;
+   Cache.HeaderP->RevDepends = 0;
+   Cache.HeaderP->RevProvides = 0;
+   Cache.RevDependsP = nullptr;
+   Cache.RevProvidesP = nullptr;
 
    // Insert the package into our package list
    if (Grp->FirstPackage == 0) // the group is new
@@ -894,6 +1089,10 @@ map_pointer<pkgCache::Version> pkgCacheGenerator::NewVersion(pkgCache::VerIterat
 					    uint32_t Hash,
 					    map_pointer<pkgCache::Version> const Next)
 {
+   Cache.HeaderP->VerRank = 0;
+   Cache.HeaderP->DepRank = 0;
+   Cache.VerRankP = nullptr;
+
    // Get a structure
    auto const Version = AllocateInMap<pkgCache::Version>();
    if (Version == 0)
@@ -1036,6 +1235,15 @@ bool pkgCacheGenerator::NewDepends(pkgCache::PkgIterator &Pkg,
 				   uint8_t const Type,
 				   map_pointer<pkgCache::Dependency> * &OldDepLast)
 {
+   Cache.HeaderP->VerRank = 0;
+   Cache.HeaderP->DepRank = 0;
+   Cache.VerRankP = nullptr;
+   Cache.DepRankP = nullptr;
+   Cache.HeaderP->RevDepends = 0;
+   Cache.HeaderP->RevProvides = 0;
+   Cache.RevDependsP = nullptr;
+   Cache.RevProvidesP = nullptr;
+
    void const * const oldMap = Map.Data();
    // Get a structure
    auto const Dependency = AllocateInMap<pkgCache::Dependency>();
@@ -1241,6 +1449,10 @@ bool pkgCacheGenerator::NewProvides(pkgCache::VerIterator &Ver,
    if (unlikely(Provides == 0))
       return false;
    ++Cache.HeaderP->ProvidesCount;
+   Cache.HeaderP->RevDepends = 0;
+   Cache.HeaderP->RevProvides = 0;
+   Cache.RevDependsP = nullptr;
+   Cache.RevProvidesP = nullptr;
 
    // Fill it in
    pkgCache::PrvIterator Prv(Cache,Cache.ProvideP + Provides,Cache.PkgP);
@@ -1478,8 +1690,9 @@ static bool CheckValidity(FileFd &CacheFile, std::string const &CacheFileName,
    std::unique_ptr<MMap> Map(new MMap(CacheFile,0));
    if (unlikely(Map->validData()) == false)
       return false;
-   std::unique_ptr<pkgCache> CacheP(new pkgCache(Map.get()));
+   std::unique_ptr<pkgCache> CacheP(new pkgCache(Map.get(), false));
    pkgCache &Cache = *CacheP.get();
+   Cache.ReMap(true, &CacheFile);
    if (_error->PendingError() || Map->Size() == 0)
    {
       if (Debug == true)
@@ -1699,17 +1912,38 @@ static bool writeBackMMapToFile(pkgCacheGenerator * const Gen, DynamicMMap * con
 
    fchmod(SCacheF.Fd(),0644);
 
+   if (Gen->Finish() == false)
+      return false;
+
    // Write out the main data
    if (SCacheF.Write(Map->Data(),Map->Size()) == false)
       return _error->Error(_("IO Error saving source cache"));
 
-   // Write out the proper header
-   Gen->GetCache().HeaderP->Dirty = false;
-   Gen->GetCache().HeaderP->CacheFileSize = Gen->GetCache().CacheHash();
+   /* Write out the proper header. It records the identity of the file, so
+      the modification time is set explicitly after writing it. Other writes
+      get a different time unless they happen in the very same nanosecond. */
+   struct stat St;
+   if (fstat(SCacheF.Fd(), &St) != 0)
+      return _error->Errno("fstat", _("Failed to stat %s"), FileName.c_str());
+   struct timespec Times[2] = {{0, UTIME_OMIT}, {0, 0}};
+   if (clock_gettime(CLOCK_REALTIME, &Times[1]) != 0)
+      return _error->Errno("clock_gettime", _("Failed to set modification time"));
+   if (Times[1].tv_nsec == 0)
+      Times[1].tv_nsec = 1;
+   pkgCache::Header * const Header = Gen->GetCache().HeaderP;
+   Header->Dirty = false;
+   Header->FileInode = St.st_ino;
+   Header->FileSize = Map->Size();
+   Header->FileModificationTime = Times[1].tv_sec;
+   Header->FileModificationTimeNsec = Times[1].tv_nsec;
+   Header->HeaderHash = Gen->GetCache().HeaderHash();
+   Header->CacheFileSize = Gen->GetCache().CacheHash();
    if (SCacheF.Seek(0) == false ||
-	 SCacheF.Write(Map->Data(),sizeof(*Gen->GetCache().HeaderP)) == false)
+	 SCacheF.Write(Map->Data(),sizeof(*Header)) == false)
       return _error->Error(_("IO Error saving source cache"));
-   Gen->GetCache().HeaderP->Dirty = true;
+   if (futimens(SCacheF.Fd(), Times) != 0)
+      return _error->Errno("futimens", _("Failed to set modification time"));
+   Header->Dirty = true;
    return true;
 }
 static bool loadBackMMapFromFile(std::unique_ptr<pkgCacheGenerator> &Gen,
@@ -1879,6 +2113,9 @@ bool pkgCacheGenerator::MakeStatusCache(pkgSourceList &List,OpProgress *Progress
 	 return false;
    }
 
+   if (Gen != nullptr && Gen->Finish() == false)
+      return false;
+
    if (OutMap != nullptr)
       *OutMap = Map.release();
 
@@ -1916,6 +2153,8 @@ bool pkgCacheGenerator::MakeOnlyStatusCache(OpProgress *Progress,DynamicMMap **O
    if (BuildCache(Gen,Progress,CurrentSize,TotalSize, NULL,
 		  Files.begin(), Files.end()) == false)
       return false;
+   if (Gen.Finish() == false)
+      return false;
 
    if (_error->PendingError() == true)
       return false;
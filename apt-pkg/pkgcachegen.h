@@ -157,6 +157,7 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
 
    void ReMap(void const * const oldMap, void * const newMap, size_t oldSize);
    bool Start();
+   APT_HIDDEN bool Finish();
 
    pkgCacheGenerator(DynamicMMap *Map,OpProgress *Progress);
    virtual ~pkgCacheGenerator();
@@ -172,6 +173,10 @@ class APT_HIDDEN pkgCacheGenerator					/*{{{*/
 			   pkgCache::VerIterator &V);
    APT_HIDDEN bool AddImplicitDepends(pkgCache::VerIterator &V, pkgCache::PkgIterator &D);
 
+   APT_HIDDEN bool BuildGroupIndex();
+   APT_HIDDEN bool BuildVersionRanks();
+   APT_HIDDEN bool BuildReverseIndex();
+
    APT_HIDDEN bool AddNewDescription(ListParser &List, pkgCache::VerIterator &Ver,
 	 std::string const &lang, std::string_view CurMd5, map_stringitem_t &md5idx);
 };
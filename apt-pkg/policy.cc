@@ -145,7 +145,6 @@ pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pk
    pkgCache::VerIterator cand;
    pkgCache::VerIterator cur = Pkg.CurrentVer();
    int candPriority = -1;
-   pkgVersioningSystem *vs = Cache->VS;
 
    for (pkgCache::VerIterator ver = Pkg.VersionList(); ver.end() == false; ++ver) {
       int priority = GetPriority(ver, true);
@@ -153,9 +152,9 @@ pkgCache::VerIterator pkgPolicy::GetCandidateVer(pkgCache::PkgIterator const &Pk
       if (priority == 0 || priority <= candPriority)
 	 continue;
 
-      // TODO: Maybe optimize to not compare versions
+      // compares the ranks of the versions if the cache has them
       if (!cur.end() && priority < 1000
-	  && (vs->CmpVersion(ver.VerStr(), cur.VerStr()) < 0))
+	  && Cache->CmpVersion(ver, cur) < 0)
 	 continue;
 
       candPriority = priority;
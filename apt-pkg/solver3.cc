@@ -93,7 +93,7 @@ struct APT::Solver::CompareProviders3 /*{{{*/
 	    return pinA > pinB;
 
 	 // Then by version
-	 return _system->VS->CmpVersion(AV.VerStr(), BV.VerStr()) > 0;
+	 return AV.Cache()->CmpVersion(AV, BV) > 0;
       }
       // Try obsolete choices only after exhausting non-obsolete choices such that we install
       // packages replacing them and don't keep back upgrades depending on the replacement to
@@ -1313,8 +1313,7 @@ bool APT::Solver::ToDepCache(pkgDepCache &depcache) const
    pkgDepCache::ActionGroup group(depcache);
    for (auto P = cache.PkgBegin(); not P.end(); P++)
    {
-      depcache[P].Marked = 0;
-      depcache[P].Garbage = 0;
+      depcache.SetMarkFlags(P, false, false);
       if ((*this)[P].decision == Decision::MUST)
       {
 	 pkgCache::VerIterator cand;
@@ -1358,14 +1357,12 @@ bool APT::Solver::ToDepCache(pkgDepCache &depcache) const
 	 else
 	    depcache.MarkKeep(P, false, reason.empty() && not(depcache[P].Flags & pkgCache::Flag::Auto));
 
-	 depcache[P].Marked = 1;
-	 depcache[P].Garbage = 0;
+	 depcache.SetMarkFlags(P, true, false);
       }
       else if (P->CurrentVer || depcache[P].Install())
       {
 	 depcache.MarkDelete(P, false, 0, not(*this)[P].reason);
-	 depcache[P].Marked = 0;
-	 depcache[P].Garbage = 1;
+	 depcache.SetMarkFlags(P, false, true);
       }
    }
    return true;
@@ -62,9 +62,17 @@ static bool ShowDepends(CommandLine &CmdL, bool const RevDepends)
 
       if (RevDepends == true)
 	 std::cout << "Reverse Depends:" << std::endl;
-      for (pkgCache::DepIterator D = RevDepends ? Pkg.RevDependsList() : Ver.DependsList();
-	    D.end() == false; ++D)
+      std::vector<pkgCache::DepIterator> Deps;
+      if (RevDepends == true && Cache->HasReverseIndex() == true)
+	 for (auto const Dep : Cache->RevDepends(Pkg))
+	    Deps.emplace_back(*Cache, Cache->DepP + Dep, Cache->PkgP);
+      else
+	 for (pkgCache::DepIterator D = RevDepends ? Pkg.RevDependsList() : Ver.DependsList();
+	       D.end() == false; ++D)
+	    Deps.push_back(D);
+      for (size_t I = 0; I < Deps.size(); ++I)
       {
+	 pkgCache::DepIterator const &D = Deps[I];
 	 switch (D->Type) {
 	    case pkgCache::Dep::PreDepends: if (!ShowPreDepends) continue; break;
 	    case pkgCache::Dep::Depends: if (!ShowDepends) continue; break;
@@ -126,7 +134,7 @@ static bool ShowDepends(CommandLine &CmdL, bool const RevDepends)
 	 }
 
 	 if (ShowOnlyFirstOr == true)
-	    while ((D->CompareOp & pkgCache::Dep::Or) == pkgCache::Dep::Or) ++D;
+	    while (I < Deps.size() && (Deps[I]->CompareOp & pkgCache::Dep::Or) == pkgCache::Dep::Or) ++I;
       }
    }
 
@@ -17,10 +17,15 @@
 #include <apt-private/private-output.h>
 #include <apt-private/private-utils.h>
 
+#include <algorithm>
+#include <cstring>
+#include <ctime>
 #include <fstream>
 #include <string>
+#include <tuple>
 #include <vector>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <pwd.h>
 #include <sys/types.h>
@@ -304,6 +309,66 @@ bool DoChangelog(CommandLine &CmdL)
    return true;
 }
 									/*}}}*/
+// CleanSharedStore - Keep Dir::Cache::Shared within its limits		/*{{{*/
+/* Other systems use the store as well, so it is never emptied: files put
+   there more than APT::Archives::Shared::MaxAge days ago are removed and
+   then the oldest until it is smaller than APT::Archives::Shared::MaxSize
+   MiB. Files we are not allowed to remove belong to someone else and are
+   left alone. */
+static void CleanSharedStore()
+{
+   if (_config->Find("Dir::Cache::Shared").empty())
+      return;
+   std::string const Store = flCombine(_config->FindDir("Dir::Cache::Shared"), "SHA256");
+   DIR * const D = opendir(Store.c_str());
+   if (D == nullptr)
+      return;
+
+   time_t const Now = time(nullptr);
+   time_t const MaxAge = _config->FindI("APT::Archives::Shared::MaxAge", 30) * 24 * 60 * 60;
+   unsigned long long const MaxSize = _config->FindI("APT::Archives::Shared::MaxSize", 0) * 1024ull * 1024ull;
+   bool const Simulate = _config->FindB("APT::Get::Simulate");
+   auto const Remove = [&](std::string const &File, unsigned long long const Size) {
+      c1out << "Del " << File << " [" << SizeToStr(Size) << "B]" << std::endl;
+      if (Simulate == false)
+	 unlink(File.c_str());
+   };
+
+   std::vector<std::tuple<time_t, unsigned long long, std::string>> Files;
+   unsigned long long Total = 0;
+   for (struct dirent *Ent = readdir(D); Ent != nullptr; Ent = readdir(D))
+   {
+      if (Ent->d_name[0] == '.')
+	 continue;
+      std::string const File = flCombine(Store, Ent->d_name);
+      struct stat St;
+      if (lstat(File.c_str(), &St) != 0 || S_ISREG(St.st_mode) == false)
+	 continue;
+      // files are copied into the store, so their mtime is when they were added
+      time_t const Added = St.st_mtime;
+      bool const Leftover = strstr(Ent->d_name, ".tmp.") != nullptr && Added + 24 * 60 * 60 < Now;
+      if (Leftover || (MaxAge != 0 && Added + MaxAge < Now))
+	 Remove(File, St.st_size);
+      else
+      {
+	 Files.emplace_back(Added, St.st_size, File);
+	 Total += St.st_size;
+      }
+   }
+   closedir(D);
+
+   if (MaxSize == 0 || Total <= MaxSize)
+      return;
+   std::sort(Files.begin(), Files.end());
+   for (auto const &[Added, Size, File] : Files)
+   {
+      if (Total <= MaxSize)
+	 break;
+      Remove(File, Size);
+      Total -= Size;
+   }
+}
+									/*}}}*/
 // DoClean & DoDistClean - Remove download archives and/or lists	/*{{{*/
 static bool CleanDownloadDirectories(bool const ListsToo)
 {
@@ -319,6 +384,7 @@ static bool CleanDownloadDirectories(bool const ListsToo)
       if (ListsToo)
 	 std::cout << "Del " << listsdir << "*_{Packages,Sources,Translation-*}" << std::endl;
       std::cout << "Del " << pkgcache << " " << srcpkgcache << std::endl;
+      CleanSharedStore();
       return true;
    }
 
@@ -339,6 +405,7 @@ static bool CleanDownloadDirectories(bool const ListsToo)
    }
 
    pkgCacheFile::RemoveCaches();
+   CleanSharedStore();
 
    return true;
 }
@@ -388,7 +455,10 @@ bool DoAutoClean(CommandLine &)
 
    LogCleaner Cleaner;
 
-   return Cleaner.Go(archivedir, *Cache) &&
-      Cleaner.Go(flCombine(archivedir, "partial/"), *Cache);
+   if (Cleaner.Go(archivedir, *Cache) == false ||
+       Cleaner.Go(flCombine(archivedir, "partial/"), *Cache) == false)
+      return false;
+   CleanSharedStore();
+   return true;
 }
 									/*}}}*/
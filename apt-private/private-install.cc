@@ -30,8 +30,12 @@
 #include <set>
 #include <sstream>
 #include <vector>
+#include <csignal>
+#include <fcntl.h>
 #include <langinfo.h>
 #include <sys/statvfs.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <apt-private/acqprogress.h>
 #include <apt-private/private-cachefile.h>
@@ -182,6 +186,148 @@ static void RemoveDownloadNeedingItemsFromFetcher(pkgAcquire &Fetcher, bool &Tra
       I = Fetcher.ItemsBegin();
    }
 }
+// InstallWhileDownloading - Unpack archives while the rest downloads	/*{{{*/
+// ---------------------------------------------------------------------
+/* The archives are queued in unpack order, so we let a child process
+   download them while we hand the archives which are already there to dpkg,
+   just like we do for media swapping. Archives only appear in the archives
+   directory once they are verified, so that is all we have to look at.
+   Once the downloader is done the caller deals with the rest as usual. */
+static bool ReportDownloader(int const Status, FileFd &Log)
+{
+   // the messages of the downloader are ours, as if we had downloaded
+   std::string Line;
+   Log.Seek(0);
+   while (Log.ReadLine(Line))
+   {
+      if (APT::String::Startswith(Line, "E: "))
+	 _error->Error("%s", Line.c_str() + 3);
+      else if (APT::String::Startswith(Line, "W: "))
+	 _error->Warning("%s", Line.c_str() + 3);
+      else if (APT::String::Startswith(Line, "N: "))
+	 _error->Notice("%s", Line.c_str() + 3);
+   }
+   if (WIFEXITED(Status) && WEXITSTATUS(Status) == 0)
+      return true;
+   if (WIFSIGNALED(Status))
+      return _error->Error(_("Sub-process %s received signal %u."), "download", WTERMSIG(Status));
+   return _error->Error(_("Sub-process %s returned an error code (%u)"), "download", WEXITSTATUS(Status));
+}
+static pkgPackageManager::OrderResult InstallWhileDownloading(pkgAcquire &Fetcher, pkgPackageManager &PM,
+							       pkgSourceList *const List, pkgRecords &Recs)
+{
+   std::unique_ptr<FileFd> Log(GetTempFile("apt-download", true));
+   if (Log == nullptr)
+      return pkgPackageManager::Failed;
+   pid_t Downloader = ExecFork({Log->Fd()});
+   if (Downloader == 0)
+   {
+      // the user is watching the progress of dpkg now
+      int const NullFd = open("/dev/null", O_WRONLY);
+      dup2(NullFd, STDOUT_FILENO);
+      dup2(Log->Fd(), STDERR_FILENO);
+      bool const Okay = Fetcher.Run() == pkgAcquire::Continue;
+      _error->DumpErrors(std::cerr, GlobalError::NOTICE);
+      std::cerr.flush();
+      _exit(Okay ? 0 : 100);
+   }
+   auto const StopDownloader = [&]() {
+      if (Downloader == -1)
+	 return;
+      kill(Downloader, SIGINT);
+      ExecWait(Downloader, "download", true);
+      Downloader = -1;
+   };
+
+   PM.SetWaitForMissing(true);
+   auto Res = pkgPackageManager::Incomplete;
+   size_t Installable = 0;
+   while (Res == pkgPackageManager::Incomplete)
+   {
+      int Status;
+      if (waitpid(Downloader, &Status, WNOHANG) == Downloader)
+      {
+	 Downloader = -1;
+	 if (ReportDownloader(Status, *Log) == false)
+	 {
+	    PM.SetWaitForMissing(false);
+	    return pkgPackageManager::Failed;
+	 }
+	 break;
+      }
+
+      // Look at what is there (again), we have seen the warnings already
+      _error->PushToStack();
+      Fetcher.Shutdown();
+      if (PM.GetArchives(&Fetcher, List, &Recs) == false || _error->PendingError() == true)
+      {
+	 _error->MergeWithStack();
+	 StopDownloader();
+	 PM.SetWaitForMissing(false);
+	 return pkgPackageManager::Failed;
+      }
+      _error->RevertToStack();
+
+      if (std::all_of(Fetcher.ItemsBegin(), Fetcher.ItemsEnd(), [](auto const Itm) { return Itm->Complete; }))
+	 break;
+      // everything we could install with the archives we had is installed
+      auto const Complete = std::count_if(Fetcher.ItemsBegin(), Fetcher.ItemsEnd(), [](auto const Itm) { return Itm->Complete; });
+      if (static_cast<size_t>(Complete) <= Installable)
+      {
+	 usleep(500 * 1000);
+	 continue;
+      }
+      Installable = Complete;
+
+      // Archives which are not there yet are missing for this run
+      for (pkgAcquire::ItemIterator I = Fetcher.ItemsBegin(); I < Fetcher.ItemsEnd();)
+      {
+	 if ((*I)->Complete == true)
+	 {
+	    ++I;
+	    continue;
+	 }
+	 (*I)->Finished();
+	 delete *I;
+	 I = Fetcher.ItemsBegin();
+      }
+
+      // if the first archive to unpack is missing, this does nothing
+      auto const progress = APT::Progress::PackageManagerProgressFactory();
+      _system->UnLockInner();
+      Res = PM.DoInstall(progress);
+      delete progress;
+      if (Res == pkgPackageManager::Failed || _error->PendingError() == true)
+      {
+	 StopDownloader();
+	 PM.SetWaitForMissing(false);
+	 return pkgPackageManager::Failed;
+      }
+      if (Res == pkgPackageManager::Incomplete)
+	 _system->LockInner();
+   }
+   PM.SetWaitForMissing(false);
+
+   if (Downloader != -1)
+   {
+      int Status;
+      while (waitpid(Downloader, &Status, 0) != Downloader)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 _error->Errno("waitpid", _("Waited for %s but it wasn't there"), "download");
+	 return pkgPackageManager::Failed;
+      }
+      if (ReportDownloader(Status, *Log) == false)
+	 return pkgPackageManager::Failed;
+   }
+   // Whatever is left (or failed to download) is fetched and installed the usual way
+   Fetcher.Shutdown();
+   if (Res == pkgPackageManager::Incomplete && PM.GetArchives(&Fetcher, List, &Recs) == false)
+      return pkgPackageManager::Failed;
+   return Res;
+}
+									/*}}}*/
 #ifdef REQUIRE_MERGED_USR
 // \brief Issues a warning about usrmerge when destructed so we can call it after install finished or failed or whatever.
 struct WarnUsrMerge {
@@ -531,7 +677,15 @@ bool InstallPackages(CacheFile &Cache, APT::PackageVector &HeldBackPackages, boo
 
    // Run it
    bool Failed = false;
-   while (1)
+   auto Installed = pkgPackageManager::Incomplete;
+   if (_config->FindB("APT::Get::Install-While-Downloading", false) == true && DownloadAllowed == true &&
+       _config->FindB("APT::Get::Download-Only", false) == false)
+   {
+      Installed = InstallWhileDownloading(Fetcher, *PM, List, Recs);
+      if (Installed == pkgPackageManager::Failed || _error->PendingError() == true)
+	 return false;
+   }
+   while (Installed != pkgPackageManager::Completed)
    {
       bool Transient = false;
       if (AcquireRun(Fetcher, 0, &Failed, &Transient) == false)
@@ -923,7 +1077,7 @@ bool DoCacheManipulationFromCommandLine(CommandLine &CmdL, std::vector<PseudoPkg
      }
 
      // Record the state before we call the solver.
-     pkgDepCache::Transaction transaction(Cache, pkgDepCache::Transaction::Behavior::COMMIT);
+     pkgDepCache::Transaction transaction(Cache, pkgDepCache::Transaction::Behavior::COMMIT, pkgDepCache::Transaction::Undo::JOURNAL);
      auto runTheSolver = [&](std::ostream &out) -> bool
      {
 	if (Fix != NULL && _config->FindB("APT::Get::AutoSolving", true) == true)
@@ -990,7 +1144,7 @@ bool DoCacheManipulationFromCommandLine(CommandLine &CmdL, std::vector<PseudoPkg
 	auto internalUpgrade = Cache->UpgradeCount();
 
 	// Create a nested transaction. When leaving this scope, we are back to the 'internal' result.
-	pkgDepCache::Transaction solver3(Cache, pkgDepCache::Transaction::Behavior::ROLLBACK);
+	pkgDepCache::Transaction solver3(Cache, pkgDepCache::Transaction::Behavior::ROLLBACK, pkgDepCache::Transaction::Undo::JOURNAL);
 	transaction.temporaryRollback(); // Rollback to before internal solver made changes
 
 	std::vector<std::string> errors;
@@ -1039,7 +1193,7 @@ bool DoCacheManipulationFromCommandLine(CommandLine &CmdL, std::vector<PseudoPkg
 
 	if (res && not error.empty() && not Cache->FindPkg("apport").end() && Cache->FindPkg("apport")->CurrentVer)
 	{
-	   pkgDepCache::Transaction dumpTransaction(Cache, pkgDepCache::Transaction::Behavior::ROLLBACK);
+	   pkgDepCache::Transaction dumpTransaction(Cache, pkgDepCache::Transaction::Behavior::ROLLBACK, pkgDepCache::Transaction::Undo::JOURNAL);
 	   transaction.temporaryRollback(); // Rollback to before internal solver made changes so we can dump the OG request
 	   WriteApportReport(Cache, error, errors, UpgradeMode, distUpgradeMode);
 	}
@@ -331,7 +331,8 @@ static bool Stats(CommandLine &CmdL)
 	   APT_CACHESIZE(VerFileCount, VerFileSz) +
 	   APT_CACHESIZE(DescFileCount, DescFileSz) +
 	   APT_CACHESIZE(ProvidesCount, ProvidesSz) +
-	   (2 * Cache->Head().GetHashTableSize() * sizeof(map_id_t));
+	   (2 * Cache->Head().GetHashTableSize() * sizeof(map_id_t)) +
+	   (Cache->Head().GrpIndex != 0 ? Cache->Head().GrpIndexSize * sizeof(pkgCache::GroupIndexSlot) : 0);
    cout << _("Total space accounted for: ") << SizeToStr(Total) << endl;
 #undef APT_CACHESIZE
 
@@ -40,6 +40,7 @@
 #include "cachedb.h"
 #include "multicompress.h"
 #include "override.h"
+#include "pdiff.h"
 #include "writer.h"
 
 #include <apti18n.h>
@@ -621,6 +622,7 @@ static bool ShowHelp(CommandLine &)					/*{{{*/
       "          sources srcpath [overridefile [pathprefix]]\n"
       "          contents path\n"
       "          release path\n"
+      "          pdiff oldfile newfile\n"
       "          generate config [groups]\n"
       "          clean config\n"
       "\n"
@@ -773,6 +775,16 @@ static bool SimpleGenRelease(CommandLine &CmdL)
    return true;
 }
 
+									/*}}}*/
+// SimpleGenPDiffs - Add the latest change of an index to its pdiffs	/*{{{*/
+// ---------------------------------------------------------------------
+static bool SimpleGenPDiffs(CommandLine &CmdL)
+{
+   if (CmdL.FileSize() != 3)
+      return ShowHelp(CmdL);
+
+   return GenPDiffs(CmdL.FileList[1], CmdL.FileList[2]);
+}
 									/*}}}*/
 // DoGeneratePackagesAndSources - Helper for Generate                   /*{{{*/
 // ---------------------------------------------------------------------
@@ -1025,6 +1037,7 @@ static std::vector<aptDispatchWithHelp> GetCommands()			/*{{{*/
       {"contents",&SimpleGenContents, nullptr},
       {"sources",&SimpleGenSources, nullptr},
       {"release",&SimpleGenRelease, nullptr},
+      {"pdiff",&SimpleGenPDiffs, nullptr},
       {"generate",&Generate, nullptr},
       {"clean",&Clean, nullptr},
       {nullptr, nullptr, nullptr}
@@ -0,0 +1,283 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   PDiff - Maintain the merged patches of an index file
+
+   The patches are kept in the format dak uses with X-Patch-Precedence:
+   merged, so each patch brings a historic version of the index straight
+   to the current one and a client only ever downloads a single patch.
+   Each run merges the existing patches with the patch for the latest
+   change via rred rather than redoing the complete history.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+#include <apt-pkg/tagfile.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pdiff.h"
+
+#include <apti18n.h>
+									/*}}}*/
+
+struct PDiffFile
+{
+   std::string Hash;
+   unsigned long long Size = 0;
+
+   bool operator==(PDiffFile const &Other) const { return Size == Other.Size && Hash == Other.Hash; }
+};
+struct PDiffEntry
+{
+   std::string Name;
+   PDiffFile History;
+   PDiffFile Patch;
+   PDiffFile Download;
+};
+
+static bool HashFile(std::string const &File, FileFd::CompressMode const Mode, PDiffFile &Out) /*{{{*/
+{
+   FileFd Fd;
+   if (Fd.Open(File, FileFd::ReadOnly, Mode) == false)
+      return false;
+   Hashes Hash(Hashes::SHA256SUM);
+   if (Hash.AddFD(Fd) == false)
+      return false;
+   Out.Hash = Hash.GetHashString(Hashes::SHA256SUM).HashValue();
+   Out.Size = Hash.GetHashStringList().FileSize();
+   return true;
+}
+									/*}}}*/
+// PDiffStamp - Names the versions of the index like dak does		/*{{{*/
+static std::string PDiffStamp(time_t const Time)
+{
+   struct tm Tm;
+   char Buffer[100];
+   if (gmtime_r(&Time, &Tm) == nullptr ||
+       strftime(Buffer, sizeof(Buffer), "%Y-%m-%d-%H%M.%S", &Tm) == 0)
+      return "";
+   return Buffer;
+}
+static time_t PDiffStampTime(std::string const &Stamp)
+{
+   struct tm Tm = {};
+   char const * const End = strptime(Stamp.c_str(), "%Y-%m-%d-%H%M.%S", &Tm);
+   if (End == nullptr || *End != '\0')
+      return 0;
+   return timegm(&Tm);
+}
+									/*}}}*/
+// RunToFile - Runs a program with its output redirected into a file	/*{{{*/
+static bool RunToFile(std::vector<char const *> Args, std::string const &Output, int &ExitCode)
+{
+   int const Fd = open(Output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (Fd == -1)
+      return _error->Errno("open", _("Failed to open %s"), Output.c_str());
+
+   Args.push_back(nullptr);
+   pid_t const Child = ExecFork();
+   if (Child == 0)
+   {
+      dup2(Fd, STDOUT_FILENO);
+      execvp(Args[0], const_cast<char **>(Args.data()));
+      _exit(100);
+   }
+   close(Fd);
+
+   int Status;
+   while (waitpid(Child, &Status, 0) != Child)
+   {
+      if (errno == EINTR)
+	 continue;
+      return _error->Errno("waitpid", _("Waited for %s but it wasn't there"), Args[0]);
+   }
+   if (WIFEXITED(Status) == 0)
+      return _error->Error(_("Sub-process %s exited unexpectedly"), Args[0]);
+   ExitCode = WEXITSTATUS(Status);
+   return true;
+}
+									/*}}}*/
+// ReadPDiffIndex - Reads the state of the previous run			/*{{{*/
+static bool ReadPDiffIndex(std::string const &IndexFile, PDiffFile &Current, std::vector<PDiffEntry> &Entries)
+{
+   FileFd Fd;
+   if (Fd.Open(IndexFile, FileFd::ReadOnly) == false)
+      return false;
+   pkgTagFile TF(&Fd);
+   pkgTagSection Tags;
+   if (TF.Step(Tags) == false)
+      return _error->Error(_("Unable to parse %s"), IndexFile.c_str());
+
+   std::istringstream CurrentStr(Tags.FindS("SHA256-Current"));
+   CurrentStr >> Current.Hash >> Current.Size;
+
+   // patches going only to the next version can't be merged with ours
+   if (Tags.FindS("X-Patch-Precedence") != "merged")
+      return true;
+
+   std::istringstream HistoryStr(Tags.FindS("SHA256-History"));
+   PDiffEntry Entry;
+   while (HistoryStr >> Entry.History.Hash >> Entry.History.Size >> Entry.Name)
+      Entries.push_back(Entry);
+   return true;
+}
+									/*}}}*/
+// WritePDiffIndex - Writes the Index file clients look at		/*{{{*/
+static bool WritePDiffIndex(std::string const &IndexFile, PDiffFile const &Current, std::vector<PDiffEntry> const &Entries)
+{
+   std::ostringstream Index;
+   Index << "SHA256-Current: " << Current.Hash << ' ' << Current.Size << '\n';
+   Index << "SHA256-History:\n";
+   for (auto const &E : Entries)
+      Index << ' ' << E.History.Hash << ' ' << E.History.Size << ' ' << E.Name << '\n';
+   Index << "SHA256-Patches:\n";
+   for (auto const &E : Entries)
+      Index << ' ' << E.Patch.Hash << ' ' << E.Patch.Size << ' ' << E.Name << '\n';
+   Index << "SHA256-Download:\n";
+   for (auto const &E : Entries)
+      Index << ' ' << E.Download.Hash << ' ' << E.Download.Size << ' ' << E.Name << ".gz\n";
+   Index << "X-Patch-Precedence: merged\n";
+
+   FileFd Fd;
+   if (Fd.Open(IndexFile, FileFd::WriteAtomic, FileFd::None, 0644) == false)
+      return false;
+   std::string const Data = Index.str();
+   if (Fd.Write(Data.c_str(), Data.length()) == false)
+      return false;
+   return Fd.Close();
+}
+									/*}}}*/
+// GenPDiffs - Adds the latest change to the merged patches		/*{{{*/
+bool GenPDiffs(std::string const &OldFile, std::string const &NewFile)
+{
+   PDiffFile Old, New;
+   if (HashFile(OldFile, FileFd::None, Old) == false ||
+       HashFile(NewFile, FileFd::None, New) == false)
+      return false;
+
+   std::string const Dir = NewFile + ".diff";
+   std::string const IndexFile = flCombine(Dir, "Index");
+   if (DirectoryExists(Dir) == false && mkdir(Dir.c_str(), 0755) != 0)
+      return _error->Errno("mkdir", _("Failed to create directory %s"), Dir.c_str());
+
+   PDiffFile Current;
+   std::vector<PDiffEntry> Entries;
+   if (FileExists(IndexFile) && ReadPDiffIndex(IndexFile, Current, Entries) == false)
+      return false;
+
+   if (Old == New)
+   {
+      if (Current == New)
+	 return true;
+      return _error->Error(_("%s and %s are identical"), OldFile.c_str(), NewFile.c_str());
+   }
+   if (Entries.empty() == false && (Current == Old) == false)
+   {
+      _error->Warning(_("Patches in %s do not end at %s, starting over"), Dir.c_str(), OldFile.c_str());
+      Entries.clear();
+   }
+
+   // every patch is named after the versions it is going from and to
+   auto const Source = [](std::string const &Name) {
+      auto const F = Name.find("-F-");
+      return F == std::string::npos ? Name : Name.substr(F + 3);
+   };
+   auto const Target = [](std::string const &Name) {
+      auto const F = Name.find("-F-");
+      return Name.substr(Name.compare(0, 2, "T-") == 0 ? 2 : 0, F == std::string::npos ? std::string::npos : F - 2);
+   };
+
+   time_t PrevTime;
+   if (Entries.empty() == false)
+      PrevTime = PDiffStampTime(Target(Entries.back().Name));
+   else
+   {
+      struct stat St;
+      if (stat(OldFile.c_str(), &St) != 0)
+	 return _error->Errno("stat", _("Failed to stat %s"), OldFile.c_str());
+      PrevTime = St.st_mtime;
+   }
+   // each version needs a distinct name, even if we are called in quick succession
+   std::string const PrevStamp = PDiffStamp(PrevTime);
+   std::string const NewStamp = PDiffStamp(std::max(time(nullptr), PrevTime + 1));
+   if (NewStamp.empty() || PrevStamp.empty())
+      return _error->Error("Unable to name the patches in %s", Dir.c_str());
+
+   // patches which are too old are not worth keeping around
+   unsigned long const MaxEntries = std::max(1, _config->FindI("APT::FTPArchive::PDiff::MaxEntries", 56));
+   if (Entries.size() >= MaxEntries)
+      Entries.erase(Entries.begin(), Entries.end() - (MaxEntries - 1));
+
+   std::string const Patch = flCombine(Dir, "T-" + NewStamp + "-F-" + PrevStamp);
+   int ExitCode = 0;
+   if (RunToFile({"diff", "--ed", OldFile.c_str(), NewFile.c_str()}, Patch, ExitCode) == false)
+      return false;
+   if (ExitCode != 1)
+   {
+      RemoveFile("GenPDiffs", Patch);
+      return _error->Error(_("Sub-process %s returned an error code (%u)"), "diff", ExitCode);
+   }
+
+   std::string const Rred = _config->FindDir("Dir::Bin::Methods") + "rred";
+   std::vector<PDiffEntry> NewEntries;
+   PDiffEntry Latest;
+   Latest.Name = flNotDir(Patch);
+   Latest.History = Old;
+   Entries.push_back(Latest);
+   for (auto &E : Entries)
+   {
+      PDiffEntry Merged = E;
+      std::vector<char const *> Args = {Rred.c_str(), "-o", "Rred::Compress=gz"};
+      std::string const Existing = flCombine(Dir, E.Name + ".gz");
+      if (E.Name != Latest.Name)
+      {
+	 Merged.Name = "T-" + NewStamp + "-F-" + Source(E.Name);
+	 Args.push_back(Existing.c_str());
+      }
+      Args.push_back(Patch.c_str());
+
+      std::string const Output = flCombine(Dir, Merged.Name + ".gz");
+      if (RunToFile(Args, Output, ExitCode) == false ||
+	  (ExitCode != 0 && _error->Error(_("Sub-process %s returned an error code (%u)"), Rred.c_str(), ExitCode) == false) ||
+	  HashFile(Output, FileFd::Gzip, Merged.Patch) == false ||
+	  HashFile(Output, FileFd::None, Merged.Download) == false)
+      {
+	 RemoveFile("GenPDiffs", Patch);
+	 return false;
+      }
+      NewEntries.push_back(std::move(Merged));
+   }
+   RemoveFile("GenPDiffs", Patch);
+
+   if (WritePDiffIndex(IndexFile, New, NewEntries) == false)
+      return false;
+
+   // remove patches which are no longer in the Index
+   for (auto const &File : GetListOfFilesInDir(Dir, "gz", false, false))
+   {
+      auto const Name = std::string{flNotDir(File)};
+      if (std::none_of(NewEntries.begin(), NewEntries.end(), [&](PDiffEntry const &E) { return E.Name + ".gz" == Name; }))
+	 RemoveFile("GenPDiffs", File);
+   }
+   return true;
+}
+									/*}}}*/
@@ -0,0 +1,17 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   PDiff - Maintain the merged patches of an index file
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PDIFF_H
+#define PDIFF_H
+
+#include <string>
+
+// Adds the changes from OldFile to NewFile to the patches in NewFile.diff/
+bool GenPDiffs(std::string const &OldFile, std::string const &NewFile);
+
+#endif
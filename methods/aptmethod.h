@@ -26,7 +26,9 @@
 #include <apti18n.h>
 
 #ifdef HAVE_SECCOMP
+#include <cerrno>
 #include <csignal>
+#include <sched.h>
 
 #include <seccomp.h>
 #endif
@@ -117,6 +119,7 @@ protected:
       BASE = (1 << 1),
       NETWORK = (1 << 2),
       DIRECTORY = (1 << 3),
+      THREADS = (1 << 4),
    };
 
    public:
@@ -368,6 +371,27 @@ protected:
 	 ALLOW(getdents64);
       }
 
+      if ((SeccompFlags & Seccomp::THREADS) != 0)
+      {
+	 // only threads may be created, not processes; s390 swaps the first arguments
+#if defined(__s390__) || defined(__s390x__)
+	 rc = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clone), 1, SCMP_A1(SCMP_CMP_MASKED_EQ, CLONE_THREAD, CLONE_THREAD));
+#else
+	 rc = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(clone), 1, SCMP_A0(SCMP_CMP_MASKED_EQ, CLONE_THREAD, CLONE_THREAD));
+#endif
+	 if (rc != 0)
+	    return _error->FatalE("HttpMethod::Configuration", "Cannot allow %s: %s", "clone", strerror(-rc));
+#ifdef __NR_clone3
+	 // the flags of clone3 are behind a pointer seccomp can't inspect,
+	 // but the libc falls back to clone if it isn't implemented
+	 if ((rc = seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOSYS), SCMP_SYS(clone3), 0)))
+	    return _error->FatalE("HttpMethod::Configuration", "Cannot deny %s: %s", "clone3", strerror(-rc));
+#endif
+#ifdef __NR_rseq
+	 ALLOW(rseq);
+#endif
+      }
+
       if (getenv("FAKED_MODE"))
       {
 	 ALLOW(semop);
@@ -448,6 +472,9 @@ protected:
       return true;
    }
 
+   /** \brief Set if a warning or an audit message was sent, reset by the method */
+   bool SentWarnings = false;
+
    void Message(std::string &&msg, std::string code)
    {
       std::unordered_map<std::string, std::string> fields;
@@ -462,10 +489,12 @@ protected:
    }
    void Warning(std::string &&msg)
    {
+      SentWarnings = true;
       return Message(std::move(msg), "104 Warning");
    }
    void Audit(std::string &&msg)
    {
+      SentWarnings = true;
       return Message(std::move(msg), "105 Audit");
    }
 
@@ -14,9 +14,13 @@
 #include <apt-pkg/debversion.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <cerrno>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
@@ -26,7 +30,9 @@
 #include <map>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -320,6 +326,171 @@ void ServerState::Reset()						/*{{{*/
    PipelineAnswersReceived = 0;
 }
 									/*}}}*/
+// StreamDecompressor::Start - Decompress From into To as it arrives	/*{{{*/
+/* We only deal with compressors we have a library for, as starting the
+   binaries of the others isn't something we can do from a sandbox. */
+static bool IsBuiltinCompressor(std::string const &Name)
+{
+#ifdef HAVE_ZLIB
+   if (Name == "gzip")
+      return true;
+#endif
+#ifdef HAVE_BZ2
+   if (Name == "bzip2")
+      return true;
+#endif
+#ifdef HAVE_LZMA
+   if (Name == "xz" || Name == "lzma")
+      return true;
+#endif
+#ifdef HAVE_LZ4
+   if (Name == "lz4")
+      return true;
+#endif
+#ifdef HAVE_ZSTD
+   if (Name == "zstd")
+      return true;
+#endif
+   return false;
+}
+bool StreamDecompressor::Start(std::string const &From, std::string const &To)
+{
+   Abort();
+   if (To.empty())
+      return false;
+
+   std::string const Extension = "." + std::string{flExtension(From)};
+   auto const Compressors = APT::Configuration::getCompressors();
+   auto const Compressor = std::find_if(Compressors.begin(), Compressors.end(),
+	 [&](APT::Configuration::Compressor const &C) { return C.Extension == Extension; });
+   if (Compressor == Compressors.end() || IsBuiltinCompressor(Compressor->Name) == false)
+      return false;
+
+   if (pipe2(Pipe, O_CLOEXEC) != 0)
+      return false;
+   Target = To;
+   Hash.reset(new Hashes(Hashes::SHA256SUM));
+   Success = false;
+   try
+   {
+      Worker = std::thread(&StreamDecompressor::Run, this, *Compressor);
+   }
+   catch (std::system_error const &)
+   {
+      Stop();
+      return false;
+   }
+   return true;
+}
+									/*}}}*/
+// StreamDecompressor::Run - Decompress the data in the pipe		/*{{{*/
+void StreamDecompressor::Run(APT::Configuration::Compressor const Compressor)
+{
+   FileFd From, To;
+   bool Good = From.OpenDescriptor(Pipe[0], FileFd::ReadOnly, Compressor, false) &&
+	       To.Open(Target, FileFd::WriteOnly | FileFd::Create | FileFd::Atomic, FileFd::None);
+   if (To.IsOpen())
+      To.EraseOnFailure();
+
+   std::array<unsigned char, APT_BUFFER_SIZE> Buffer;
+   while (Good)
+   {
+      unsigned long long Count = 0;
+      if (From.Read(Buffer.data(), Buffer.size(), &Count) == false)
+	 Good = false;
+      else if (Count == 0)
+	 break;
+      else
+      {
+	 Hash->Add(Buffer.data(), Count);
+	 Good = To.Write(Buffer.data(), Count);
+      }
+   }
+   if (Good == false && To.IsOpen())
+      To.OpFail();
+   From.Close();
+   Good &= To.Close();
+
+   // the download must not block on us, even if we have given up
+   for (ssize_t Res = 1; Res != 0;)
+   {
+      Res = read(Pipe[0], Buffer.data(), Buffer.size());
+      if (Res < 0 && errno != EINTR)
+	 break;
+   }
+
+   // failures are not fatal, the file is just decompressed afterwards
+   _error->Discard();
+   Success = Good;
+}
+									/*}}}*/
+// StreamDecompressor::Add - Feed in compressed data			/*{{{*/
+void StreamDecompressor::Add(unsigned char const *Data, size_t Size)
+{
+   if (Pipe[1] == -1)
+      return;
+   while (Size != 0)
+   {
+      ssize_t const Res = write(Pipe[1], Data, Size);
+      if (Res < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 close(Pipe[1]);
+	 Pipe[1] = -1;
+	 return;
+      }
+      Data += Res;
+      Size -= Res;
+   }
+}
+									/*}}}*/
+// StreamDecompressor::Finish - Wait for the decompressed file		/*{{{*/
+bool StreamDecompressor::Finish(time_t const Date, std::string &Filename, HashStringList &Hashes)
+{
+   if (Worker.joinable() == false)
+      return false;
+   bool const Complete = Pipe[1] != -1;
+   Stop();
+   if (Complete == false || Success == false)
+   {
+      RemoveFile("StreamDecompressor::Finish", Target);
+      return false;
+   }
+
+   struct timeval times[2];
+   times[0].tv_sec = times[1].tv_sec = Date;
+   times[0].tv_usec = times[1].tv_usec = 0;
+   utimes(Target.c_str(), times);
+
+   Filename = Target;
+   Hashes = Hash->GetHashStringList();
+   return true;
+}
+									/*}}}*/
+// StreamDecompressor::Abort - Drop the decompressed file		/*{{{*/
+void StreamDecompressor::Abort()
+{
+   if (Worker.joinable() == false)
+      return;
+   Stop();
+   RemoveFile("StreamDecompressor::Abort", Target);
+}
+void StreamDecompressor::Stop()
+{
+   if (Pipe[1] != -1)
+      close(Pipe[1]);
+   if (Worker.joinable())
+      Worker.join();
+   if (Pipe[0] != -1)
+      close(Pipe[0]);
+   Pipe[0] = Pipe[1] = -1;
+}
+StreamDecompressor::~StreamDecompressor()
+{
+   Abort();
+}
+									/*}}}*/
 
 // BaseHttpMethod::DealWithHeaders - Handle the retrieved header data	/*{{{*/
 // ---------------------------------------------------------------------
@@ -789,6 +960,7 @@ int BaseHttpMethod::Loop()
 	    // Close the file, destroy the FD object and timestamp it
 	    FailFd = -1;
 	    Req.File.Close();
+	    FetchItem const * const Requested = Queue;
 
 	    // Timestamp
 	    struct timeval times[2];
@@ -835,10 +1007,27 @@ int BaseHttpMethod::Loop()
 		  Server->PipelineAnswersReceived++;
 	       }
 	       Res.TakeHashes(*resultHashes);
-	       URIDone(Res);
+	       // a reordered pipeline means we decompressed the wrong file
+	       FetchResult Decompressed;
+	       StreamDecompressor * const Decompress = Server->GetDecompress();
+	       if (Decompress != nullptr && Queue == Requested &&
+		   Decompress->Finish(Req.Date, Decompressed.Filename, Decompressed.Hashes))
+	       {
+		  Decompressed.LastModified = Req.Date;
+		  Decompressed.Size = Decompressed.Hashes.FileSize();
+		  URIDone(Res, &Decompressed);
+	       }
+	       else
+	       {
+		  if (Decompress != nullptr)
+		     Decompress->Abort();
+		  URIDone(Res);
+	       }
 	    }
 	    else
 	    {
+	       if (StreamDecompressor * const Decompress = Server->GetDecompress(); Decompress != nullptr)
+		  Decompress->Abort();
 	       if (not Server->IsOpen())
 	       {
 		  // Reset the pipeline
@@ -938,6 +1127,22 @@ int BaseHttpMethod::Loop()
    return 0;
 }
 									/*}}}*/
+// BaseHttpMethod::URIAcquire - Remember where to decompress the item to	/*{{{*/
+bool BaseHttpMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
+{
+   std::string const To = LookupTag(Message, "Decompress-To");
+   if (To.empty() || ConfigFindB("Decompress", true) == false)
+      DecompressTo.erase(Itm);
+   else
+      DecompressTo[Itm] = To;
+   return aptAuthConfMethod::URIAcquire(Message, Itm);
+}
+std::string BaseHttpMethod::GetDecompressTo(FetchItem const *Itm) const
+{
+   auto const To = DecompressTo.find(Itm);
+   return To == DecompressTo.end() ? "" : To->second;
+}
+									/*}}}*/
 unsigned long long BaseHttpMethod::FindMaximumObjectSizeInQueue() const	/*{{{*/
 {
    unsigned long long MaxSizeInQueue = 0;
@@ -12,6 +12,7 @@
 #define APT_SERVER_H
 
 #include "aptmethod.h"
+#include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
 
@@ -19,6 +20,8 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 using std::cout;
 using std::endl;
@@ -27,6 +30,32 @@ class Hashes;
 class BaseHttpMethod;
 struct ServerState;
 
+/** \brief Decompresses a file while it is downloaded
+ *
+ * The compressed data is fed in as it is written to the file and a
+ * thread writes the decompressed data into the target file, so the
+ * index doesn't need to be read once more to decompress it afterwards.
+ */
+class StreamDecompressor
+{
+   int Pipe[2] = {-1, -1};
+   std::thread Worker;
+   std::string Target;
+   std::unique_ptr<Hashes> Hash;
+   bool Success = false;
+
+   void Run(APT::Configuration::Compressor const Compressor);
+   void Stop();
+
+   public:
+   bool Start(std::string const &From, std::string const &To);
+   void Add(unsigned char const *Data, size_t Size);
+   bool Finish(time_t const Date, std::string &Filename, HashStringList &Hashes);
+   void Abort();
+
+   ~StreamDecompressor();
+};
+
 enum class HaveContent
 {
    TRI_UNKNOWN,
@@ -118,6 +147,8 @@ struct ServerState
    virtual bool Flush(FileFd *const File, bool MustComplete = false) = 0;
    virtual ResultState Go(bool ToFile, RequestState &Req) = 0;
    virtual Hashes * GetHashes() = 0;
+   virtual bool InitDecompress(std::string const &From, std::string const &To) = 0;
+   virtual StreamDecompressor * GetDecompress() = 0;
 
    ServerState(URI Srv, BaseHttpMethod *Owner);
    virtual ~ServerState() {};
@@ -130,6 +161,8 @@ class BaseHttpMethod : public aptAuthConfMethod
 
    std::unique_ptr<ServerState> Server;
    std::string NextURI;
+   // files we are asked to decompress the items into while downloading
+   std::unordered_map<FetchItem const *, std::string> DecompressTo;
 
    bool AllowRedirect;
 
@@ -141,6 +174,9 @@ class BaseHttpMethod : public aptAuthConfMethod
    bool Debug;
    unsigned long PipelineDepth;
 
+   bool URIAcquire(std::string const &Message, FetchItem *Itm) override;
+   std::string GetDecompressTo(FetchItem const *Itm) const;
+
    /** \brief Result of the header parsing */
    enum DealWithHeadersResult {
       /** \brief The file is open and ready */
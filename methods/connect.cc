@@ -24,11 +24,15 @@
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <limits>
 #include <list>
+#include <map>
 #include <set>
 #include <sstream>
 #include <string>
@@ -40,6 +44,7 @@
 #include <netinet/in.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include "aptmethod.h"
 #include "connect.h"
@@ -54,6 +59,46 @@ static struct addrinfo *LastUsed = 0;
 
 static std::vector<SrvRec> SrvRecords;
 
+/* Resolver results are cached per host (and service), so that reconnecting
+   or being redirected back and forth between hosts does not block on the
+   resolver each time. LastHostAddr and LastUsed point into the entry of the
+   host we talk to currently. */
+struct AddrInfoDeleter
+{
+   void operator()(struct addrinfo *const ai) { freeaddrinfo(ai); }
+};
+struct ResolvedHost
+{
+   std::unique_ptr<struct addrinfo, AddrInfoDeleter> Addresses;
+   struct addrinfo *LastUsed = nullptr;
+   time_t Expires = 0;
+};
+static std::map<std::string, ResolvedHost> ResolvedHosts;
+static ResolvedHost *LastResolved = nullptr;
+
+struct ResolvedSrv
+{
+   std::vector<SrvRec> Records;
+   time_t Expires = 0;
+};
+static std::map<std::string, ResolvedSrv> ResolvedSrvs;
+
+static time_t ResolverCacheExpires()
+{
+   auto const Lifetime = _config->FindI("Acquire::Connect::Cache-Lifetime", 300);
+   if (Lifetime <= 0)
+      return std::numeric_limits<time_t>::max();
+   return time(nullptr) + Lifetime;
+}
+// failed lookups are retried soon, they might have been a temporary failure
+static time_t ResolverNegativeCacheExpires()
+{
+   auto Lifetime = _config->FindI("Acquire::Connect::Negative-Cache-Lifetime", 10);
+   if (auto const Positive = _config->FindI("Acquire::Connect::Cache-Lifetime", 300); Positive > 0)
+      Lifetime = std::min(Lifetime, Positive);
+   return time(nullptr) + std::max(0, Lifetime);
+}
+
 // Set of IP/hostnames that we timed out before or couldn't resolve
 static std::set<std::string> bad_addr;
 
@@ -359,17 +404,25 @@ static ResultState ConnectToHostname(std::string const &Host, int const Port,
    /* We used a cached address record.. Yes this is against the spec but
       the way we have setup our rotating dns suggests that this is more
       sensible */
-   if (LastHost != Host || LastService != ServiceNameOrPort)
+   auto &Resolved = ResolvedHosts[Host + ' ' + ServiceNameOrPort];
+   if (&Resolved != LastResolved)
+   {
+      // remember how far we rotated through the addresses of the previous host
+      if (LastResolved != nullptr)
+	 LastResolved->LastUsed = LastUsed;
+      LastResolved = &Resolved;
+      LastHostAddr = Resolved.Addresses.get();
+      LastUsed = Resolved.LastUsed;
+   }
+   if (LastHostAddr == nullptr || Resolved.Expires <= time(nullptr))
    {
       Owner->Status(_("Connecting to %s"),Host.c_str());
 
       // Free the old address structure
-      if (LastHostAddr != 0)
-      {
-	 freeaddrinfo(LastHostAddr);
-	 LastHostAddr = 0;
-	 LastUsed = 0;
-      }
+      Resolved.Addresses.reset();
+      Resolved.LastUsed = nullptr;
+      LastHostAddr = 0;
+      LastUsed = 0;
       
       // We only understand SOCK_STREAM sockets.
       struct addrinfo Hints;
@@ -439,10 +492,12 @@ static ResultState ConnectToHostname(std::string const &Host, int const Port,
 	 }
 	 break;
       }
-      
-      LastHost = Host;
-      LastService = ServiceNameOrPort;
+
+      Resolved.Addresses.reset(LastHostAddr);
+      Resolved.Expires = ResolverCacheExpires();
    }
+   LastHost = Host;
+   LastService = ServiceNameOrPort;
 
    // When we have an IP rotation stay with the last IP.
    auto Addresses = OrderAddresses(LastUsed != nullptr ? LastUsed : LastHostAddr);
@@ -494,7 +549,17 @@ ResultState Connect(std::string Host, int Port, const char *Service,
       SrvRecords.clear();
       if (_config->FindB("Acquire::EnableSrvRecords", true) == true)
       {
-         GetSrvRecords(Host, DefPort, SrvRecords);
+	 // the service name queried for is derived from DefPort
+	 auto &Resolved = ResolvedSrvs[Host + ' ' + std::to_string(DefPort)];
+	 if (Resolved.Expires <= time(nullptr))
+	 {
+	    Resolved.Records.clear();
+	    if (GetSrvRecords(Host, DefPort, Resolved.Records) && not Resolved.Records.empty())
+	       Resolved.Expires = ResolverCacheExpires();
+	    else
+	       Resolved.Expires = ResolverNegativeCacheExpires();
+	 }
+	 SrvRecords = Resolved.Records;
 	 // RFC2782 defines that a lonely '.' target is an abort reason
 	 if (SrvRecords.size() == 1 && SrvRecords[0].target.empty())
 	 {
@@ -814,6 +879,7 @@ struct TlsFd final : public MethodFd
    SSL *ssl{};
 
    std::string hostname{};
+   std::string sessionKey{};
    unsigned long Timeout{};
    bool broken{false};
 
@@ -875,6 +941,9 @@ struct TlsFd final : public MethodFd
 	    res = SSL_shutdown(ssl);
 	 if (res < 0)
 	    HandleError(res);
+	 // Without this, OpenSSL considers the session bad and no longer resumable
+	 if (not broken)
+	    SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
 	 SSL_free(ssl);
       }
       ssl = nullptr;
@@ -926,6 +995,147 @@ static BIO_METHOD *NewBioMethod()
    return m;
 }
 
+// TLS session cache						/*{{{*/
+// ---------------------------------------------------------------------
+/* Sessions (or TLS 1.3 tickets) handed out by servers are kept per host and
+   port, so reconnecting to a server - in this process or, if
+   Dir::Cache::TLSSessions is set, in a later method run - can resume instead
+   of doing a full handshake. A resumed session skips the verification of the
+   certificate, so sessions are only kept if the peer was verified and are
+   also keyed on the settings it was verified with. */
+struct TlsSessionDeleter
+{
+   void operator()(SSL_SESSION *const s) { SSL_SESSION_free(s); }
+};
+static std::map<std::string, std::unique_ptr<SSL_SESSION, TlsSessionDeleter>> TlsSessions;
+
+static std::string TlsSessionCacheFile()
+{
+   if (not _config->Exists("Dir::Cache::TLSSessions"))
+      return "";
+   return _config->FindFile("Dir::Cache::TLSSessions");
+}
+static std::string TlsSessionKey(std::string const &host, int const port, aptConfigWrapperForMethods const *const OwnerConf)
+{
+   if (not OwnerConf->ConfigFindB("Session-Cache", true) || not OwnerConf->ConfigFindB("Verify-Peer", true))
+      return "";
+   std::string key;
+   strprintf(key, host.find(':') == std::string::npos ? "%s:%d" : "[%s]:%d", host.c_str(), port);
+   key.append(" Verify-Host=").append(OwnerConf->ConfigFindB("Verify-Host", true) ? "1" : "0");
+   for (auto const option : {"CaInfo", "SslCert", "SslKey", "CrlFile"})
+      key.append(" ").append(option).append("=").append(OwnerConf->ConfigFind(option, ""));
+   return key;
+}
+static bool TlsSessionUsable(SSL_SESSION const *const sess)
+{
+   return SSL_SESSION_is_resumable(sess) == 1 &&
+	  SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) > time(nullptr);
+}
+using TlsSessionMap = std::map<std::string, std::unique_ptr<SSL_SESSION, TlsSessionDeleter>>;
+static void ReadTlsSessions(std::string const &file, TlsSessionMap &sessions)
+{
+   // The file contains session secrets: ignore it unless it is private to us
+   struct stat St;
+   if (lstat(file.c_str(), &St) != 0 || not S_ISREG(St.st_mode) ||
+       St.st_uid != geteuid() || (St.st_mode & 0077) != 0)
+      return;
+
+   FileFd Cache;
+   if (not Cache.Open(file, FileFd::ReadOnly))
+   {
+      _error->Discard();
+      return;
+   }
+   std::string line;
+   for (char buf[8192]; Cache.ReadLine(buf, sizeof(buf)) != nullptr;)
+   {
+      line = buf;
+      if (not line.empty() && line.back() == '\n')
+	 line.pop_back();
+      // the key can contain spaces, the base64 encoded session can't
+      auto const space = line.rfind(' ');
+      if (space == std::string::npos)
+	 continue;
+      auto const der = Base64Decode(std::string_view{line}.substr(space + 1));
+      auto data = reinterpret_cast<unsigned char const *>(der.data());
+      std::unique_ptr<SSL_SESSION, TlsSessionDeleter> sess{d2i_SSL_SESSION(nullptr, &data, der.size())};
+      if (sess != nullptr && TlsSessionUsable(sess.get()))
+	 sessions[line.substr(0, space)] = std::move(sess);
+   }
+}
+static std::string TlsSessionDER(SSL_SESSION *const sess)
+{
+   auto const len = i2d_SSL_SESSION(sess, nullptr);
+   if (len <= 0)
+      return "";
+   std::string der(len, '\0');
+   auto data = reinterpret_cast<unsigned char *>(der.data());
+   i2d_SSL_SESSION(sess, &data);
+   return der;
+}
+static void LoadTlsSessions()
+{
+   static bool loaded = false;
+   if (loaded)
+      return;
+   loaded = true;
+
+   if (auto const file = TlsSessionCacheFile(); not file.empty())
+      ReadTlsSessions(file, TlsSessions);
+}
+/* A method process runs for each host, so the file is shared by several
+   processes writing it concurrently: the session of the host is merged
+   into the current content of the file while holding a lock on it. This
+   happens during the handshake, so if another process holds the lock the
+   session is only kept in memory rather than waiting for it. */
+static void SaveTlsSession(std::string const &key)
+{
+   auto const file = TlsSessionCacheFile();
+   if (file.empty())
+      return;
+
+   // Failing to store sessions only costs a full handshake next time
+   int const lock = GetLock(file + ".lock", false);
+   _error->Discard();
+   if (lock == -1)
+      return;
+
+   TlsSessionMap sessions;
+   ReadTlsSessions(file, sessions);
+   std::string content;
+   for (auto const &[k, sess] : sessions)
+   {
+      if (k == key)
+	 continue;
+      if (auto const der = TlsSessionDER(sess.get()); not der.empty())
+	 content.append(k).append(" ").append(Base64Encode(der)).append("\n");
+   }
+   if (auto const sess = TlsSessions.find(key); sess != TlsSessions.end() && TlsSessionUsable(sess->second.get()))
+      if (auto const der = TlsSessionDER(sess->second.get()); not der.empty())
+	 content.append(key).append(" ").append(Base64Encode(der)).append("\n");
+
+   FileFd Cache;
+   if (not Cache.Open(file, FileFd::WriteAtomic, 0600) ||
+       not Cache.Write(content.data(), content.size()) || not Cache.Close())
+      _error->Discard();
+   close(lock);
+}
+static int NewTlsSession(SSL *const ssl, SSL_SESSION *const sess)
+{
+   auto const key = static_cast<std::string const *>(SSL_get_app_data(ssl));
+   if (key == nullptr || key->empty() || not SSL_SESSION_is_resumable(sess) ||
+       SSL_get_verify_result(ssl) != X509_V_OK)
+      return 0;
+   // servers may hand out the same ticket again, which needs no rewrite
+   auto &known = TlsSessions[*key];
+   bool const changed = known == nullptr || TlsSessionDER(known.get()) != TlsSessionDER(sess);
+   // returning 1 means we keep the reference we were handed
+   known.reset(sess);
+   if (changed)
+      SaveTlsSession(*key);
+   return 1;
+}
+									/*}}}*/
 static SSL_CTX *GetContextForHost(std::string const &host, aptConfigWrapperForMethods const *const OwnerConf)
 {
    static std::string lastHost;
@@ -956,6 +1166,14 @@ static SSL_CTX *GetContextForHost(std::string const &host, aptConfigWrapperForMe
    if (ctx == nullptr)
       return null_error("Could not create new SSL context: %s", ssl_strerr());
 
+   if (OwnerConf->ConfigFindB("Session-Cache", true))
+   {
+      // We do our own per-host bookkeeping, so OpenSSL only needs to tell us about new sessions
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(ctx, NewTlsSession);
+      LoadTlsSessions();
+   }
+
    // Load the certificate authorities, either custom or default ones
    if (auto const fileinfo = OwnerConf->ConfigFind("CaInfo", ""); not fileinfo.empty())
    {
@@ -993,7 +1211,7 @@ static SSL_CTX *GetContextForHost(std::string const &host, aptConfigWrapperForMe
    return ctx;
 }
 
-ResultState UnwrapTLS(std::string const &Host, std::unique_ptr<MethodFd> &Fd,
+ResultState UnwrapTLS(std::string const &Host, int const Port, std::unique_ptr<MethodFd> &Fd,
 		      unsigned long const Timeout, aptMethod *const /*Owner*/,
 		      aptConfigWrapperForMethods const *const OwnerConf)
 {
@@ -1044,6 +1262,20 @@ ResultState UnwrapTLS(std::string const &Host, std::unique_ptr<MethodFd> &Fd,
       }
    }
 
+   // only now that the verification is set up a session may be resumed
+   tlsFd->sessionKey = TlsSessionKey(Host, Port, OwnerConf);
+   SSL_set_app_data(tlsFd->ssl, &tlsFd->sessionKey);
+   if (auto const sess = TlsSessions.find(tlsFd->sessionKey); not tlsFd->sessionKey.empty() && sess != TlsSessions.end())
+   {
+      if (TlsSessionUsable(sess->second.get()) && SSL_set_session(tlsFd->ssl, sess->second.get()) == 1)
+      {
+	 if (OwnerConf->DebugEnabled())
+	    std::clog << "Trying to resume TLS session for " << Host << std::endl;
+      }
+      else
+	 TlsSessions.erase(sess);
+   }
+
    // set SNI only if the hostname is really a name and not an address
    {
       struct in_addr addr4;
@@ -1080,6 +1312,9 @@ ResultState UnwrapTLS(std::string const &Host, std::unique_ptr<MethodFd> &Fd,
       }
    }
 
+   if (OwnerConf->DebugEnabled())
+      std::clog << (SSL_session_reused(tlsFd->ssl) ? "Resumed" : "Established new") << " TLS session with " << Host << std::endl;
+
    // Set the FD now, so closing it works reliably.
    tlsFd->UnderlyingFd = std::move(Fd);
    Fd.reset(tlsFd);
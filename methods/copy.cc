@@ -18,8 +18,12 @@
 #include <apt-pkg/strutl.h>
 
 #include <string>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include <apti18n.h>
 									/*}}}*/
@@ -79,9 +83,13 @@ bool CopyMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
       if (not From.IsOpen() || not To.IsOpen())
 	 continue;
 
-      // Copy the file
+      // Copy the file, sharing the data with the source if the filesystem can
       URIStart(Res);
+#ifdef FICLONE
+      if (ioctl(To.Fd(), FICLONE, From.Fd()) != 0 && not CopyFile(From, To))
+#else
       if (not CopyFile(From, To))
+#endif
       {
 	 To.OpFail();
 	 continue;
@@ -91,7 +99,11 @@ bool CopyMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 
       CalculateHashes(Itm, Res);
       if (not Itm->ExpectedHashes.empty() && Itm->ExpectedHashes != Res.Hashes)
+      {
+	 // don't leave a complete, but wrong file behind for others to resume
+	 RemoveFile("copy", Res.Filename);
 	 continue;
+      }
 
       if (not TransferModificationTimes(File.name.c_str(), Res.Filename.c_str(), Res.LastModified))
 	 continue;
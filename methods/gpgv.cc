@@ -125,7 +125,7 @@ class GPGVMethod : public aptMethod
    protected:
    bool URIAcquire(std::string const &Message, FetchItem *Itm) override;
    public:
-   GPGVMethod() : aptMethod("gpgv", "1.1", SingleInstance | SendConfig | SendURIEncoded){};
+   GPGVMethod() : aptMethod("gpgv", "1.1", SendConfig | SendURIEncoded){};
 };
 static void PushEntryWithKeyID(std::vector<std::string> &Signers, char * const buffer, bool const Debug)
 {
@@ -492,6 +492,21 @@ bool GPGVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
    std::string const Path = DecodeSendURI(Get.Host + Get.Path); // To account for relative paths
    SignersStorage Signers;
 
+   // verified before with the same keyrings, see Dir::Cache::Signatures
+   if (auto const Verified = LookupTag(Message, "Verified-Signed-By"); not Verified.empty())
+   {
+      std::unordered_map<std::string, std::string> fields;
+      fields.emplace("URI", Itm->Uri);
+      fields.emplace("Filename", Itm->DestFile);
+      fields.emplace("Signed-By", SubstVar(Verified, ",", "\n"));
+      if (auto const Output = LookupTag(Message, "Verified-GPGVOutput"); not Output.empty())
+	 fields.emplace("GPGVOutput", DeQuoteString(Output));
+      SendMessage("201 URI Done", std::move(fields));
+      Dequeue();
+      return true;
+   }
+   SentWarnings = false;
+
    std::vector<std::string> keyFpts, keyFiles;
    struct TemporaryFile
    {
@@ -606,6 +621,9 @@ bool GPGVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
 	 fields.emplace("GPGVOutput", out.str());
       }
    }
+   // only verifications without any remarks can be remembered by apt
+   if (not SentWarnings && _error->empty(GlobalError::NOTICE))
+      fields.emplace("Signature-Cacheable", "yes");
    SendMessage("201 URI Done", std::move(fields));
    Dequeue();
 
@@ -62,7 +62,7 @@ const unsigned int CircleBuf::BW_HZ=10;
 // ---------------------------------------------------------------------
 /* */
 CircleBuf::CircleBuf(HttpMethod const * const Owner, unsigned long long Size)
-   : Size(Size), Hash(NULL), TotalWriten(0)
+   : Size(Size), Hash(NULL), Decompress(nullptr), TotalWriten(0)
 {
    Buf = new unsigned char[Size];
    Reset();
@@ -86,6 +86,8 @@ void CircleBuf::Reset()
       delete Hash;
       Hash = NULL;
    }
+   delete Decompress;
+   Decompress = nullptr;
 }
 									/*}}}*/
 // CircleBuf::Read - Read from a FD into the circular buffer		/*{{{*/
@@ -218,6 +220,8 @@ bool CircleBuf::Write(std::unique_ptr<MethodFd> const &Fd)
 
       if (Hash != NULL)
 	 Hash->Add(Buf + (OutP%Size),Res);
+      if (Decompress != nullptr)
+	 Decompress->Add(Buf + (OutP%Size),Res);
       
       OutP += Res;
    }
@@ -274,6 +278,7 @@ CircleBuf::~CircleBuf()							/*{{{*/
 {
    delete [] Buf;
    delete Hash;
+   delete Decompress;
 }
 									/*}}}*/
 
@@ -520,7 +525,7 @@ ResultState HttpServerState::Open()
       {
 	 aptConfigWrapperForMethods ProxyConf{std::vector<std::string>{"http", "https"}};
 	 ProxyConf.setPostfixForMethodNames(Proxy.Host.c_str());
-	 result = UnwrapTLS(Proxy.Host, ServerFd, TimeOut, Owner, &ProxyConf);
+	 result = UnwrapTLS(Proxy.Host, Port, ServerFd, TimeOut, Owner, &ProxyConf);
 	 if (result != ResultState::SUCCESSFUL)
 	    return result;
       }
@@ -533,7 +538,7 @@ ResultState HttpServerState::Open()
    }
 
    if (tls)
-      return UnwrapTLS(ServerName.Host, ServerFd, TimeOut, Owner, Owner);
+      return UnwrapTLS(ServerName.Host, ServerName.Port == 0 ? DefaultPort : ServerName.Port, ServerFd, TimeOut, Owner, Owner);
 
    return ResultState::SUCCESSFUL;
 }
@@ -697,6 +702,24 @@ APT_PURE Hashes * HttpServerState::GetHashes()				/*{{{*/
    return In.Hash;
 }
 									/*}}}*/
+bool HttpServerState::InitDecompress(std::string const &From, std::string const &To) /*{{{*/
+{
+   delete In.Decompress;
+   In.Decompress = nullptr;
+   if (To.empty())
+      return false;
+   auto Decompress = std::make_unique<StreamDecompressor>();
+   if (Decompress->Start(From, To) == false)
+      return false;
+   In.Decompress = Decompress.release();
+   return true;
+}
+									/*}}}*/
+APT_PURE StreamDecompressor * HttpServerState::GetDecompress()		/*{{{*/
+{
+   return In.Decompress;
+}
+									/*}}}*/
 // HttpServerState::Die - The server has closed the connection.		/*{{{*/
 ResultState HttpServerState::Die(RequestState &Req)
 {
@@ -1019,13 +1042,15 @@ BaseHttpMethod::DealWithHeadersResult HttpMethod::DealWithHeaders(FetchResult &R
    }
    if (Req.StartPos > 0)
       Res.ResumePoint = Req.StartPos;
+   // we can only decompress what we get from the start
+   Server->InitDecompress(Queue->DestFile, Req.StartPos == 0 ? GetDecompressTo(Queue) : "");
 
    return FILE_IS_OPEN;
 }
 									/*}}}*/
 HttpMethod::HttpMethod(std::string &&pProg) : BaseHttpMethod(std::move(pProg), "1.2", Pipeline | SendConfig | SendURIEncoded) /*{{{*/
 {
-   SeccompFlags = aptMethod::BASE | aptMethod::NETWORK | aptMethod::DIRECTORY;
+   SeccompFlags = aptMethod::BASE | aptMethod::NETWORK | aptMethod::DIRECTORY | aptMethod::THREADS;
 
    auto addName = std::inserter(methodNames, methodNames.begin());
    if (Binary != "http")
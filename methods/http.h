@@ -63,6 +63,7 @@ class CircleBuf
 
    public:
    Hashes *Hash;
+   StreamDecompressor *Decompress;
    // total amount of data that got written so far
    unsigned long long TotalWriten;
 
@@ -113,6 +114,8 @@ struct HttpServerState final : public ServerState
    bool Close() override;
    bool InitHashes(HashStringList const &ExpectedHashes) override;
    Hashes * GetHashes() override;
+   bool InitDecompress(std::string const &From, std::string const &To) override;
+   StreamDecompressor * GetDecompress() override;
    ResultState Die(RequestState &Req) override;
    bool Flush(FileFd *File, bool MustComplete = true) override;
    ResultState Go(bool ToFile, RequestState &Req) override;
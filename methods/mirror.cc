@@ -19,8 +19,12 @@
 #include <apt-pkg/sourcelist.h>
 #include <apt-pkg/strutl.h>
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
+#include <limits>
 #include <random>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 
@@ -54,7 +58,7 @@ class MirrorMethod : public aptMethod /*{{{*/
    {
       std::string uri;
       unsigned long priority = std::numeric_limits<decltype(priority)>::max();
-      decltype(genrng)::result_type seed = 0;
+      double seed = 0;
       std::unordered_map<std::string, std::vector<std::string>> tags;
       explicit MirrorInfo(std::string const &u, std::vector<std::string> &&ptags = {}) : uri(u)
       {
@@ -88,6 +92,16 @@ class MirrorMethod : public aptMethod /*{{{*/
       std::vector<MirrorInfo> list;
    };
    std::unordered_map<std::string, MirrorListInfo> mirrorfilestate;
+   struct HostStats
+   {
+      double latency = 0; // in microseconds
+      double bandwidth = 0; // in bytes per second
+   };
+   std::unordered_map<std::string, HostStats> hoststats;
+   bool hoststatsloaded = false;
+
+   void LoadHostStats();
+   double ExpectedTime(std::string const &uri, unsigned long long const size) const;
 
    bool URIAcquire(std::string const &Message, FetchItem *Itm) override;
 
@@ -135,9 +149,31 @@ void MirrorMethod::RedirectItem(MirrorListInfo const &info, FetchItem *const Itm
 	 continue;
       possMirrors.push_back(mirror);
    }
+   /* Mirrors of the same priority are ordered randomly, but the faster a mirror
+      was in the past, the more likely it is to be tried first. Each mirror draws an
+      exponential random with a mean of the time it would take to get the file */
+   LoadHostStats();
+   auto const size = Itm->ExpectedHashes.FileSize() != 0 ? Itm->ExpectedHashes.FileSize() : Itm->MaximumSize;
+   double fastest = std::numeric_limits<double>::infinity();
    for (auto &&mirror : possMirrors)
-      mirror.seed = genrng();
-   std::sort(possMirrors.begin(), possMirrors.end(), [](MirrorInfo const &a, MirrorInfo const &b) {
+   {
+      mirror.seed = ExpectedTime(mirror.uri, size);
+      if (mirror.seed > 0)
+	 fastest = std::min(fastest, mirror.seed);
+   }
+   std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1.0);
+   bool const random = ConfigFindB("Random", true);
+   for (auto &&mirror : possMirrors)
+   {
+      // mirrors we know nothing about should be tried, too
+      if (mirror.seed <= 0)
+	 mirror.seed = std::isinf(fastest) ? 1.0 : fastest;
+      if (DebugEnabled())
+	 std::clog << "Mirror " << mirror.uri << " is expected to take " << mirror.seed << "s for " << Itm->Uri << std::endl;
+      if (random)
+	 mirror.seed *= -std::log(uniform(genrng));
+   }
+   std::stable_sort(possMirrors.begin(), possMirrors.end(), [](MirrorInfo const &a, MirrorInfo const &b) {
       if (a.priority != b.priority)
 	 return a.priority < b.priority;
       return a.seed < b.seed;
@@ -176,6 +212,42 @@ void MirrorMethod::RedirectItem(MirrorListInfo const &info, FetchItem *const Itm
    delete Itm;
 }
 									/*}}}*/
+void MirrorMethod::LoadHostStats()					/*{{{*/
+{
+   if (hoststatsloaded)
+      return;
+   hoststatsloaded = true;
+   std::string const file = _config->FindFile("Dir::State::MirrorStats");
+   FileFd stats;
+   if (file.empty() || RealFileExists(file) == false || stats.Open(file, FileFd::ReadOnly) == false)
+   {
+      _error->Discard();
+      return;
+   }
+   std::string line;
+   while (stats.ReadLine(line))
+   {
+      std::istringstream str(line);
+      std::string host;
+      HostStats hs;
+      if (str >> host >> hs.latency >> hs.bandwidth)
+	 hoststats[host] = hs;
+   }
+}
+									/*}}}*/
+double MirrorMethod::ExpectedTime(std::string const &uri, unsigned long long const size) const /*{{{*/
+{
+   // keyed like pkgAcquire::HostStatsKey does it
+   ::URI const u(uri);
+   auto const hs = hoststats.find(u.Port == 0 ? u.Host : u.Host + ':' + std::to_string(u.Port));
+   if (hs == hoststats.end())
+      return -1;
+   double time = hs->second.latency / 1000000;
+   if (hs->second.bandwidth > 0)
+      time += size / hs->second.bandwidth;
+   return std::max(time, 1e-6);
+}
+									/*}}}*/
 void MirrorMethod::DealWithPendingItems(std::vector<std::string> const &baseuris, /*{{{*/
 					MirrorListInfo const &info, FetchItem *const Itm,
 					std::function<void()> handler)
@@ -22,7 +22,9 @@
 
 #include <cstddef>
 #include <iostream>
-#include <list>
+#include <iterator>
+#include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -178,9 +180,212 @@ struct Change {
    }
 };
 
+/* The changes are kept in file order in a treap - a binary tree balanced by
+   random priorities - in which every node also knows how many lines of the
+   patched file the changes in its subtree span, so that finding the change
+   responsible for a given line takes O(log n) steps rather than walking over
+   all changes in between. Merging many patches with scattered changes would
+   otherwise be quadratic. */
+class ChangeTree {
+   struct Node {
+      Change change;
+      Node *left = nullptr;
+      Node *right = nullptr;
+      Node *parent = nullptr;
+      unsigned int priority = 0;
+      size_t lines = 0; // offset + add_cnt of all changes in this subtree
+
+      explicit Node(Change const &c) : change(c) {}
+   };
+   Node *root = nullptr;
+   std::minstd_rand random;
+
+   static size_t lines_of(Node const *const n) { return n == nullptr ? 0 : n->lines; }
+   static void recount(Node *const n)
+   {
+      n->lines = n->change.offset + n->change.add_cnt + lines_of(n->left) + lines_of(n->right);
+   }
+   static void recount_upwards(Node *n)
+   {
+      for (; n != nullptr; n = n->parent)
+	 recount(n);
+   }
+   static Node *leftmost(Node *n)
+   {
+      if (n != nullptr)
+	 while (n->left != nullptr)
+	    n = n->left;
+      return n;
+   }
+   static Node *rightmost(Node *n)
+   {
+      if (n != nullptr)
+	 while (n->right != nullptr)
+	    n = n->right;
+      return n;
+   }
+   static Node *successor(Node *n)
+   {
+      if (n->right != nullptr)
+	 return leftmost(n->right);
+      while (n->parent != nullptr && n->parent->right == n)
+	 n = n->parent;
+      return n->parent;
+   }
+   static Node *predecessor(Node *n)
+   {
+      if (n->left != nullptr)
+	 return rightmost(n->left);
+      while (n->parent != nullptr && n->parent->left == n)
+	 n = n->parent;
+      return n->parent;
+   }
+
+   /* moves n one level up, keeping the order of the nodes intact */
+   void rotate_up(Node *const n)
+   {
+      Node *const p = n->parent;
+      Node *const g = p->parent;
+      if (p->left == n) {
+	 p->left = n->right;
+	 if (p->left != nullptr)
+	    p->left->parent = p;
+	 n->right = p;
+      } else {
+	 p->right = n->left;
+	 if (p->right != nullptr)
+	    p->right->parent = p;
+	 n->left = p;
+      }
+      p->parent = n;
+      n->parent = g;
+      if (g == nullptr)
+	 root = n;
+      else if (g->left == p)
+	 g->left = n;
+      else
+	 g->right = n;
+      recount(p);
+      recount(n);
+   }
+
+   static void destroy(Node *const n)
+   {
+      if (n == nullptr)
+	 return;
+      destroy(n->left);
+      destroy(n->right);
+      delete n;
+   }
+
+   public:
+   class iterator {
+      ChangeTree const *tree = nullptr;
+      Node *node = nullptr;
+      friend class ChangeTree;
+
+      iterator(ChangeTree const *const tree, Node *const node) : tree(tree), node(node) {}
+
+      public:
+      using iterator_category = std::bidirectional_iterator_tag;
+      using value_type = Change;
+      using difference_type = std::ptrdiff_t;
+      using pointer = Change *;
+      using reference = Change &;
+
+      iterator() = default;
+      Change &operator*() const { return node->change; }
+      Change *operator->() const { return &node->change; }
+      // like std::list, stepping over the end wraps around (write_diff relies on it)
+      iterator &operator++() { node = (node == nullptr) ? leftmost(tree->root) : successor(node); return *this; }
+      iterator operator++(int) { iterator old = *this; ++*this; return old; }
+      iterator &operator--() { node = (node == nullptr) ? rightmost(tree->root) : predecessor(node); return *this; }
+      iterator operator--(int) { iterator old = *this; --*this; return old; }
+      bool operator==(iterator const &other) const { return node == other.node; }
+   };
+   using reverse_iterator = std::reverse_iterator<iterator>;
+
+   ChangeTree() = default;
+   ChangeTree(ChangeTree const &) = delete;
+   ChangeTree &operator=(ChangeTree const &) = delete;
+   ~ChangeTree() { destroy(root); }
+
+   iterator begin() const { return iterator(this, leftmost(root)); }
+   iterator end() const { return iterator(this, nullptr); }
+   reverse_iterator rbegin() const { return reverse_iterator(end()); }
+   reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+   /* inserts c in front of where, returning an iterator to it */
+   iterator insert(iterator const where, Change const &c)
+   {
+      Node *const n = new Node(c);
+      n->priority = random();
+      recount(n);
+      if (root == nullptr)
+	 root = n;
+      else if (where.node == nullptr) {
+	 n->parent = rightmost(root);
+	 n->parent->right = n;
+      } else if (where.node->left == nullptr) {
+	 n->parent = where.node;
+	 n->parent->left = n;
+      } else {
+	 n->parent = rightmost(where.node->left);
+	 n->parent->right = n;
+      }
+      recount_upwards(n->parent);
+      while (n->parent != nullptr && n->parent->priority < n->priority)
+	 rotate_up(n);
+      return iterator(this, n);
+   }
+
+   /* removes the change at where, returning an iterator to the next one */
+   iterator erase(iterator const where)
+   {
+      Node *const n = where.node;
+      Node *const next = successor(n);
+      while (n->left != nullptr && n->right != nullptr)
+	 rotate_up(n->left->priority > n->right->priority ? n->left : n->right);
+      Node *const child = (n->left != nullptr) ? n->left : n->right;
+      if (child != nullptr)
+	 child->parent = n->parent;
+      if (n->parent == nullptr)
+	 root = child;
+      else if (n->parent->left == n)
+	 n->parent->left = child;
+      else
+	 n->parent->right = child;
+      recount_upwards(n->parent);
+      delete n;
+      return iterator(this, next);
+   }
+
+   /* has to be called after offset or add_cnt of the change at where changed */
+   void update(iterator const where) { recount_upwards(where.node); }
+
+   /* finds the first change which spans beyond line, and the line it starts on */
+   iterator seek(size_t const line, size_t &pos) const
+   {
+      pos = 0;
+      for (Node *n = root; n != nullptr;) {
+	 size_t const start = pos + lines_of(n->left);
+	 if (line < start)
+	    n = n->left;
+	 else if (line < start + n->change.offset + n->change.add_cnt) {
+	    pos = start;
+	    return iterator(this, n);
+	 } else {
+	    pos = start + n->change.offset + n->change.add_cnt;
+	    n = n->right;
+	 }
+      }
+      return end();
+   }
+};
+
 class FileChanges {
-   std::list<struct Change> changes;
-   std::list<struct Change>::iterator where;
+   ChangeTree changes;
+   ChangeTree::iterator where;
    size_t pos; // line number is as far left of iterator as possible
 
    bool pos_is_okay(void) const
@@ -188,7 +393,7 @@ class FileChanges {
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
       // this isn't unsafe, it is just a moderately expensive check we want to avoid normally
       size_t cpos = 0;
-      std::list<struct Change>::const_iterator x;
+      ChangeTree::iterator x;
       for (x = changes.begin(); x != where; ++x) {
 	 assert(x != changes.end());
 	 cpos += x->offset + x->add_cnt;
@@ -205,11 +410,11 @@ class FileChanges {
       pos = 0;
    }
 
-   std::list<struct Change>::iterator begin(void) { return changes.begin(); }
-   std::list<struct Change>::iterator end(void) { return changes.end(); }
+   ChangeTree::iterator begin(void) { return changes.begin(); }
+   ChangeTree::iterator end(void) { return changes.end(); }
 
-   std::list<struct Change>::reverse_iterator rbegin(void) { return changes.rbegin(); }
-   std::list<struct Change>::reverse_iterator rend(void) { return changes.rend(); }
+   ChangeTree::reverse_iterator rbegin(void) { return changes.rbegin(); }
+   ChangeTree::reverse_iterator rend(void) { return changes.rend(); }
 
    bool add_change(Change c) {
       assert(pos_is_okay());
@@ -232,6 +437,7 @@ class FileChanges {
 	 where->add_len = c.add_len;
 	 where->add_cnt = c.add_cnt;
 	 where->add = c.add;
+	 changes.update(where);
       }
       assert(pos_is_okay());
       if (not merge())
@@ -246,7 +452,7 @@ class FileChanges {
 	 if (not left())
 	    return false;
       }
-      std::list<struct Change>::iterator next = where;
+      ChangeTree::iterator next = where;
       ++next;
 
       while (next != changes.end() && next->offset == 0) {
@@ -258,6 +464,7 @@ class FileChanges {
 	    where->add = next->add;
 	    where->add_len = next->add_len;
 	    where->add_cnt = next->add_cnt;
+	    changes.update(where);
 	    next = changes.erase(next);
 	 } else {
 	    ++next;
@@ -268,23 +475,13 @@ class FileChanges {
 
    bool go_to_change_for(size_t line)
    {
-      while(where != changes.end()) {
-	 if (line < pos) {
-	    if (not left())
-	       return false;
-	    continue;
-	 }
-	 if (pos + where->offset + where->add_cnt <= line) {
-	    if (not right())
-	       return false;
-	    continue;
-	 }
+      where = changes.seek(line, pos);
+      if (where != changes.end()) {
+	 assert(pos_is_okay());
 	 // line is somewhere in this slot
-	 if (line < pos + where->offset) {
-	    break;
-	 } else if (line == pos + where->offset) {
+	 if (line == pos + where->offset)
 	    return true;
-	 } else {
+	 if (line > pos + where->offset) {
 	    if (not split(line - pos))
 	       return false;
 	    return right();
@@ -301,10 +498,11 @@ class FileChanges {
       assert(pos_is_okay());
       if (where != changes.end() && offset > where->offset)
 	 return false;
-      if (where != changes.end())
+      if (where != changes.end()) {
 	 where->offset -= offset;
-      changes.insert(where, Change(offset));
-      --where;
+	 changes.update(where);
+      }
+      where = changes.insert(where, Change(offset));
       return pos_is_okay();
    }
 
@@ -322,19 +520,19 @@ class FileChanges {
       where->offset = 0;
       if (not where->skip_lines(keep_lines))
 	 return false;
+      changes.update(where);
 
       before.add_cnt = keep_lines;
       before.add_len -= where->add_len;
 
-      changes.insert(where, before);
-      --where;
+      where = changes.insert(where, before);
       return pos_is_okay();
    }
 
    bool delete_lines(size_t cnt)
    {
       assert(pos_is_okay());
-      std::list<struct Change>::iterator x = where;
+      ChangeTree::iterator x = where;
       while (cnt > 0)
       {
 	 size_t del;
@@ -343,6 +541,7 @@ class FileChanges {
 	    del = cnt;
 	 if (not x->skip_lines(del))
 	    return false;
+	 changes.update(x);
 	 cnt -= del;
 
 	 ++x;
@@ -353,6 +552,7 @@ class FileChanges {
 	    if (del > cnt)
 	       del = cnt;
 	    x->offset -= del;
+	    changes.update(x);
 	 }
 	 where->del_cnt += del;
 	 cnt -= del;
@@ -390,42 +590,83 @@ class Patch {
       return true;
    }
 
-   static void dump_rest(FileFd &o, FileFd &i,
+   /* The input is read in large blocks and unchanged lines are passed on in
+      runs rather than one by one: memchr finds the line ends far faster than
+      ReadLine and the output and the hashes get a few large chunks. */
+   class InputBuffer {
+      FileFd &f;
+      std::unique_ptr<char[]> const buffer;
+      size_t start = 0;
+      size_t end = 0;
+
+      public:
+      explicit InputBuffer(FileFd &f) : f(f), buffer(new char[APT_MEMBLOCK_SIZE]) {}
+
+      /* returns the yet unused part of the buffer, refilling it if need be */
+      bool data(char *&b, size_t &l)
+      {
+	 if (start == end) {
+	    unsigned long long actual = 0;
+	    start = end = 0;
+	    if (f.Read(buffer.get(), APT_MEMBLOCK_SIZE, &actual) == false || actual == 0)
+	       return false;
+	    end = actual;
+	 }
+	 b = buffer.get() + start;
+	 l = end - start;
+	 return true;
+      }
+      void consume(size_t const l) { start += l; }
+   };
+
+   /* consumes the next n lines, writing them to o if given;
+      a missing line at the end of the input counts as empty */
+   static void pass_lines(FileFd * const o, InputBuffer &i, size_t n,
 	 Hashes * const start_hash, Hashes * const end_hash)
    {
-      char buffer[APT_MEMBLOCK_SIZE];
-      unsigned long long l = 0;
-      while (i.Read(buffer, sizeof(buffer), &l)) {
-	 if (l ==0  || !retry_fwrite(buffer, l, o, start_hash, end_hash))
-	    break;
+      char *b;
+      size_t l;
+      while (n > 0 && i.data(b, l)) {
+	 char const * const e = b + l;
+	 char const *p = b;
+	 while (n > 0) {
+	    char const * const nl = static_cast<char const *>(memchr(p, '\n', e - p));
+	    if (nl == nullptr) {
+	       p = e;
+	       break;
+	    }
+	    p = nl + 1;
+	    --n;
+	 }
+	 l = p - b;
+	 if (o != nullptr)
+	    retry_fwrite(b, l, *o, start_hash, end_hash);
+	 else if (start_hash)
+	    start_hash->Add(reinterpret_cast<unsigned char *>(b), l);
+	 i.consume(l);
       }
    }
 
-   static void dump_lines(FileFd &o, FileFd &i, size_t n,
+   static void dump_lines(FileFd &o, InputBuffer &i, size_t n,
 	 Hashes * const start_hash, Hashes * const end_hash)
    {
-      char buffer[APT_MEMBLOCK_SIZE];
-      while (n > 0) {
-	 if (i.ReadLine(buffer, sizeof(buffer)) == NULL)
-	    buffer[0] = '\0';
-	 size_t const l = strlen(buffer);
-	 if (l == 0 || buffer[l-1] == '\n')
-	    n--;
-	 retry_fwrite(buffer, l, o, start_hash, end_hash);
-      }
+      pass_lines(&o, i, n, start_hash, end_hash);
    }
 
-   static void skip_lines(FileFd &i, int n, Hashes * const start_hash)
+   static void skip_lines(InputBuffer &i, size_t n, Hashes * const start_hash)
    {
-      char buffer[APT_MEMBLOCK_SIZE];
-      while (n > 0) {
-	 if (i.ReadLine(buffer, sizeof(buffer)) == NULL)
-	    buffer[0] = '\0';
-	 size_t const l = strlen(buffer);
-	 if (l == 0 || buffer[l-1] == '\n')
-	    n--;
-	 if (start_hash)
-	    start_hash->Add((unsigned char*)buffer, l);
+      pass_lines(nullptr, i, n, start_hash, nullptr);
+   }
+
+   static void dump_rest(FileFd &o, InputBuffer &i,
+	 Hashes * const start_hash, Hashes * const end_hash)
+   {
+      char *b;
+      size_t l;
+      while (i.data(b, l)) {
+	 if (!retry_fwrite(b, l, o, start_hash, end_hash))
+	    break;
+	 i.consume(l);
       }
    }
 
@@ -539,22 +780,28 @@ class Patch {
    void write_diff(FileFd &f)
    {
       unsigned long long line = 0;
-      std::list<struct Change>::reverse_iterator ch;
+      ChangeTree::reverse_iterator ch;
       for (ch = filechanges.rbegin(); ch != filechanges.rend(); ++ch) {
 	 line += ch->offset + ch->del_cnt;
       }
 
       for (ch = filechanges.rbegin(); ch != filechanges.rend(); ++ch) {
-	 std::list<struct Change>::reverse_iterator mg_i, mg_e = ch;
+	 ChangeTree::reverse_iterator mg_i, mg_e = ch;
+	 size_t add_cnt = ch->add_cnt;
 	 while (ch->del_cnt == 0 && ch->offset == 0)
 	 {
 	    ++ch;
 	    if (unlikely(ch == filechanges.rend()))
-	       return;
+	    {
+	       // the lines are added in front of the first line
+	       --ch;
+	       break;
+	    }
+	    add_cnt += ch->add_cnt;
 	 }
 	 line -= ch->del_cnt;
 	 std::string buf;
-	 if (ch->add_cnt > 0) {
+	 if (add_cnt > 0) {
 	    if (ch->del_cnt == 0) {
 	       strprintf(buf, "%llua\n", line);
 	    } else if (ch->del_cnt == 1) {
@@ -585,14 +832,15 @@ class Patch {
    void apply_against_file(FileFd &out, FileFd &in,
 	 Hashes * const start_hash = nullptr, Hashes * const end_hash = nullptr)
    {
-      std::list<struct Change>::iterator ch;
+      InputBuffer input(in);
+      ChangeTree::iterator ch;
       for (ch = filechanges.begin(); ch != filechanges.end(); ++ch) {
-	 dump_lines(out, in, ch->offset, start_hash, end_hash);
-	 skip_lines(in, ch->del_cnt, start_hash);
+	 dump_lines(out, input, ch->offset, start_hash, end_hash);
+	 skip_lines(input, ch->del_cnt, start_hash);
 	 if (ch->add_len != 0)
 	    dump_mem(out, ch->add, ch->add_len, end_hash);
       }
-      dump_rest(out, in, start_hash, end_hash);
+      dump_rest(out, input, start_hash, end_hash);
       out.Flush();
    }
 };
@@ -623,6 +871,47 @@ class RredMethod final : public aptMethod {
 	 return ExpectedHashes;
       }
 
+      /* writes the patches merged into one to DestFile, which can then be
+	 merged with or applied together with the patches coming after it */
+      bool MergePatches(Patch &patch, std::vector<PDiffFile> const &patchfiles, FetchResult &Res, FetchItem *Itm)
+      {
+	 if (patchfiles.empty())
+	    return _error->Error("No patches found to merge into %s", Itm->DestFile.c_str());
+	 if (Debug == true)
+	    std::clog << "Merging patches into " << Itm->DestFile << std::endl;
+
+	 // patches are always stored compressed, see URIAcquire
+	 FileFd out;
+	 if (out.Open(Itm->DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::BufferedWrite, FileFd::Gzip) == false)
+	    return _error->Error("Failed to open out %s", Itm->DestFile.c_str());
+	 patch.write_diff(out);
+	 if (out.Close() == false)
+	    return false;
+
+	 Hashes merged_hash(patchfiles.back().ExpectedHashes);
+	 FileFd merged;
+	 if (merged.Open(Itm->DestFile, FileFd::ReadOnly, FileFd::Gzip) == false ||
+	       merged_hash.AddFD(merged) == false)
+	    return _error->Error("Failed to read merged patch %s", Itm->DestFile.c_str());
+	 merged.Close();
+
+	 // the patched file gets the modification time of the last patch
+	 struct stat bufpatch;
+	 if (stat(patchfiles.back().FileName.c_str(), &bufpatch) != 0)
+	    return _error->Errno("stat", _("Failed to stat %s"), patchfiles.back().FileName.c_str());
+	 struct timeval times[2];
+	 times[0].tv_sec = times[1].tv_sec = bufpatch.st_mtime;
+	 times[0].tv_usec = times[1].tv_usec = 0;
+	 if (utimes(Itm->DestFile.c_str(), times) != 0)
+	    return _error->Errno("utimes",_("Failed to set modification time"));
+
+	 Res.LastModified = bufpatch.st_mtime;
+	 Res.Size = merged_hash.GetHashStringList().FileSize();
+	 Res.TakeHashes(merged_hash);
+	 URIDone(Res);
+	 return true;
+      }
+
    protected:
       bool URIAcquire(std::string const &Message, FetchItem *Itm) override {
 	 Debug = DebugEnabled();
@@ -706,6 +995,9 @@ class RredMethod final : public aptMethod {
 	       return _error->Error("Hash Sum mismatch for uncompressed patch %s", patch_name.c_str());
 	 }
 
+	 if (StringToBool(LookupTag(Message, "Merge-Patches"), false))
+	    return MergePatches(patch, patchfiles, Res, Itm);
+
 	 if (Debug == true)
 	    std::clog << "Applying patches against " << Path
 	       << " and writing results to " << Itm->DestFile
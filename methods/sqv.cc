@@ -28,7 +28,7 @@ class SQVMethod : public aptMethod
    SQVMethod();
 };
 
-SQVMethod::SQVMethod() : aptMethod("sqv", "1.1", SingleInstance | SendConfig | SendURIEncoded)
+SQVMethod::SQVMethod() : aptMethod("sqv", "1.1", SendConfig | SendURIEncoded)
 {
 }
 
@@ -349,6 +349,19 @@ bool SQVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
    URI const Get(Itm->Uri);
    std::string const Path = DecodeSendURI(Get.Host + Get.Path); // To account for relative paths
 
+   // verified before with the same keyrings, see Dir::Cache::Signatures
+   if (auto const Verified = LookupTag(Message, "Verified-Signed-By"); not Verified.empty())
+   {
+      std::unordered_map<std::string, std::string> fields;
+      fields.emplace("URI", Itm->Uri);
+      fields.emplace("Filename", Itm->DestFile);
+      fields.emplace("Signed-By", SubstVar(Verified, ",", "\n"));
+      SendMessage("201 URI Done", std::move(fields));
+      Dequeue();
+      return true;
+   }
+   SentWarnings = false;
+
    std::vector<std::string> Signers, keyFpts, keyFiles;
    struct TemporaryFile
    {
@@ -402,6 +415,9 @@ bool SQVMethod::URIAcquire(std::string const &Message, FetchItem *Itm)
    fields.emplace("URI", Itm->Uri);
    fields.emplace("Filename", Itm->DestFile);
    fields.emplace("Signed-By", APT::String::Join(Signers, "\n"));
+   // only verifications without any remarks can be remembered by apt
+   if (not SentWarnings && _error->empty(GlobalError::NOTICE))
+      fields.emplace("Signature-Cacheable", "yes");
    SendMessage("201 URI Done", std::move(fields));
    Dequeue();
 
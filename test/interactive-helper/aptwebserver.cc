@@ -23,6 +23,7 @@
 
 #include <array>
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <list>
@@ -788,6 +789,10 @@ static void * handleClient(int const client, size_t const id)		/*{{{*/
 	    }
 	 }
 
+	 // slow downloads can be tested with this
+	 if (int const delay = _config->FindI("aptwebserver::delay::" + filename, 0); delay > 0)
+	    std::this_thread::sleep_for(std::chrono::seconds(delay));
+
 	 // deal with the request
 	 unsigned int const httpsport = _config->FindI("aptwebserver::port::https", 4433);
 	 std::string hosthttpsport;
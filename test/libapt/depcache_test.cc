@@ -0,0 +1,253 @@
+#include <config.h>
+
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/cachefile.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/depcache.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/pkgcache.h>
+
+#include <cstring>
+#include <string>
+
+#include "common.h"
+#include "file-helpers.h"
+
+using Transaction = pkgDepCache::Transaction;
+
+/* pkga depends on pkgb, so removing pkgb breaks pkga,
+   while pkgc and the required pkgd can be changed without breaking anything */
+static char const *const statusFile = "Package: pkga\nStatus: install ok installed\nVersion: 1\nArchitecture: all\nDepends: pkgb\n\n"
+				      "Package: pkgb\nStatus: install ok installed\nVersion: 1\nArchitecture: all\n\n"
+				      "Package: pkgc\nStatus: install ok installed\nVersion: 1\nArchitecture: all\n\n"
+				      "Package: pkgd\nStatus: install ok installed\nPriority: required\nVersion: 1\nArchitecture: all\n";
+
+static void openCache(std::string const &tempdir, pkgCacheFile &CacheFile)
+{
+   FileFd status;
+   ASSERT_TRUE(status.Open(tempdir + "/status", FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   ASSERT_TRUE(status.Write(statusFile, strlen(statusFile)));
+   ASSERT_TRUE(status.Close());
+
+   _config->Set("APT::Architecture", "amd64");
+   _config->Set("APT::Architectures", "amd64");
+   APT::Configuration::getArchitectures(false);
+   _config->Set("Dir::State::status", tempdir + "/status");
+   _config->Set("Dir::State::extended_states", tempdir + "/extended_states");
+   _config->Set("Dir::State::lists", tempdir);
+   _config->Set("Dir::Etc::sourcelist", "/dev/null");
+   _config->Set("Dir::Etc::sourceparts", "/dev/null");
+   _config->Set("Dir::Etc::preferences", "/dev/null");
+   _config->Set("Dir::Etc::preferencesparts", "/dev/null");
+   _config->Set("Dir::Cache::pkgcache", "");
+   _config->Set("Dir::Cache::srcpkgcache", "");
+   ASSERT_TRUE(CacheFile.Open(nullptr, false));
+}
+
+static void expectState(pkgDepCache &Cache, bool const DeleteB, bool const AutoC)
+{
+   auto const A = Cache.FindPkg("pkga");
+   auto const B = Cache.FindPkg("pkgb");
+   auto const C = Cache.FindPkg("pkgc");
+   auto const Dep = A.CurrentVer().DependsList();
+   EXPECT_EQ(DeleteB, Cache[B].Delete());
+   EXPECT_EQ(DeleteB ? 1u : 0u, Cache.DelCount());
+   EXPECT_EQ(DeleteB ? 1u : 0u, Cache.BrokenCount());
+   EXPECT_EQ(DeleteB, (Cache[Dep] & pkgDepCache::DepInstall) == 0);
+   EXPECT_EQ(AutoC, (Cache[C].Flags & pkgCache::Flag::Auto) != 0);
+}
+
+TEST(DepCacheTest, TransactionRollback)
+{
+   std::string tempdir;
+   createTemporaryDirectory("depcache", tempdir);
+   for (auto const undo : {Transaction::Undo::COPY, Transaction::Undo::JOURNAL})
+   {
+      SCOPED_TRACE(undo == Transaction::Undo::COPY ? "copy" : "journal");
+      pkgCacheFile CacheFile;
+      ASSERT_NO_FATAL_FAILURE(openCache(tempdir, CacheFile));
+      pkgDepCache &Cache = *CacheFile.GetDepCache();
+      expectState(Cache, false, false);
+      {
+	 Transaction T(Cache, Transaction::Behavior::ROLLBACK, undo);
+	 EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+	 Cache.MarkAuto(Cache.FindPkg("pkgc"), true);
+	 expectState(Cache, true, true);
+      }
+      expectState(Cache, false, false);
+
+      // AUTO rolls back only if more packages are broken
+      {
+	 Transaction T(Cache, Transaction::Behavior::AUTO, undo);
+	 EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+      }
+      expectState(Cache, false, false);
+      {
+	 Transaction T(Cache, Transaction::Behavior::AUTO, undo);
+	 Cache.MarkAuto(Cache.FindPkg("pkgc"), true);
+      }
+      expectState(Cache, false, true);
+   }
+   removeDirectory(tempdir);
+}
+
+TEST(DepCacheTest, TransactionNestedCommit)
+{
+   std::string tempdir;
+   createTemporaryDirectory("depcache", tempdir);
+   for (auto const undo : {Transaction::Undo::COPY, Transaction::Undo::JOURNAL})
+   {
+      SCOPED_TRACE(undo == Transaction::Undo::COPY ? "copy" : "journal");
+      pkgCacheFile CacheFile;
+      ASSERT_NO_FATAL_FAILURE(openCache(tempdir, CacheFile));
+      pkgDepCache &Cache = *CacheFile.GetDepCache();
+      {
+	 Transaction Outer(Cache, Transaction::Behavior::ROLLBACK, undo);
+	 Cache.MarkAuto(Cache.FindPkg("pkgc"), true);
+	 {
+	    Transaction Inner(Cache, Transaction::Behavior::ROLLBACK, undo);
+	    EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+	    Inner.commit();
+	 }
+	 // the committed changes are kept until the outer one is rolled back
+	 expectState(Cache, true, true);
+      }
+      expectState(Cache, false, false);
+
+      {
+	 Transaction Outer(Cache, Transaction::Behavior::COMMIT, undo);
+	 {
+	    Transaction Inner(Cache, Transaction::Behavior::COMMIT, undo);
+	    EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+	 }
+      }
+      expectState(Cache, true, false);
+   }
+   removeDirectory(tempdir);
+}
+
+TEST(DepCacheTest, TransactionOutOfOrderRollback)
+{
+   std::string tempdir;
+   createTemporaryDirectory("depcache", tempdir);
+   for (auto const undo : {Transaction::Undo::COPY, Transaction::Undo::JOURNAL})
+   {
+      SCOPED_TRACE(undo == Transaction::Undo::COPY ? "copy" : "journal");
+      pkgCacheFile CacheFile;
+      ASSERT_NO_FATAL_FAILURE(openCache(tempdir, CacheFile));
+      pkgDepCache &Cache = *CacheFile.GetDepCache();
+      {
+	 Transaction Outer(Cache, Transaction::Behavior::COMMIT, undo);
+	 EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+	 {
+	    Transaction Inner(Cache, Transaction::Behavior::ROLLBACK, undo);
+	    // like apt install does to compare the results of two solvers
+	    Outer.temporaryRollback();
+	    expectState(Cache, false, false);
+	    Cache.MarkAuto(Cache.FindPkg("pkgc"), true);
+	    expectState(Cache, false, true);
+	 }
+	 // the inner one returns to the state it was opened in
+	 expectState(Cache, true, false);
+	 Outer.rollback();
+	 expectState(Cache, false, false);
+      }
+      expectState(Cache, false, false);
+   }
+   removeDirectory(tempdir);
+}
+
+TEST(DepCacheTest, TransactionDirectChanges)
+{
+   std::string tempdir;
+   createTemporaryDirectory("depcache", tempdir);
+   pkgCacheFile CacheFile;
+   ASSERT_NO_FATAL_FAILURE(openCache(tempdir, CacheFile));
+   pkgDepCache &Cache = *CacheFile.GetDepCache();
+   auto const C = Cache.FindPkg("pkgc");
+
+   // a copy undoes changes nobody told the depcache about
+   {
+      Transaction T(Cache, Transaction::Behavior::ROLLBACK);
+      Cache[C].Flags |= pkgCache::Flag::Auto;
+      expectState(Cache, false, true);
+   }
+   expectState(Cache, false, false);
+
+   // a journal only if they are recorded
+   {
+      Transaction T(Cache, Transaction::Behavior::ROLLBACK, Transaction::Undo::JOURNAL);
+      Cache.JournalPkgState(C->ID);
+      Cache[C].Flags |= pkgCache::Flag::Auto;
+      expectState(Cache, false, true);
+   }
+   expectState(Cache, false, false);
+   removeDirectory(tempdir);
+}
+
+TEST(DepCacheTest, TransactionMixedUndo)
+{
+   std::string tempdir;
+   createTemporaryDirectory("depcache", tempdir);
+   pkgCacheFile CacheFile;
+   ASSERT_NO_FATAL_FAILURE(openCache(tempdir, CacheFile));
+   pkgDepCache &Cache = *CacheFile.GetDepCache();
+
+   // a copy rolled back within a journal is recorded in the journal
+   {
+      Transaction Outer(Cache, Transaction::Behavior::ROLLBACK, Transaction::Undo::JOURNAL);
+      Cache.MarkAuto(Cache.FindPkg("pkgc"), true);
+      {
+	 Transaction Inner(Cache, Transaction::Behavior::ROLLBACK, Transaction::Undo::COPY);
+	 EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+	 expectState(Cache, true, true);
+      }
+      expectState(Cache, false, true);
+   }
+   expectState(Cache, false, false);
+
+   // a journal committed within a copy has nobody to hand its changes to
+   {
+      Transaction Outer(Cache, Transaction::Behavior::ROLLBACK, Transaction::Undo::COPY);
+      {
+	 Transaction Inner(Cache, Transaction::Behavior::COMMIT, Transaction::Undo::JOURNAL);
+	 EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkgb")));
+	 Cache.MarkAuto(Cache.FindPkg("pkgc"), true);
+      }
+      expectState(Cache, true, true);
+   }
+   expectState(Cache, false, false);
+   removeDirectory(tempdir);
+}
+
+TEST(DepCacheTest, MarkAndSweep)
+{
+   std::string tempdir;
+   createTemporaryDirectory("depcache", tempdir);
+   pkgCacheFile CacheFile;
+   ASSERT_NO_FATAL_FAILURE(openCache(tempdir, CacheFile));
+   pkgDepCache &Cache = *CacheFile.GetDepCache();
+   for (auto const Name : {"pkgb", "pkgc", "pkgd"})
+      Cache.MarkAuto(Cache.FindPkg(Name), true);
+
+   // the sequential and the parallel mark have to agree on the sweep
+   for (auto const Threads : {1, 4})
+   {
+      _config->Set("APT::AutoRemove::Threads", Threads);
+      ASSERT_TRUE(Cache.MarkAndSweep());
+      EXPECT_FALSE(Cache[Cache.FindPkg("pkga")].Garbage);
+      EXPECT_FALSE(Cache[Cache.FindPkg("pkgb")].Garbage);
+      EXPECT_TRUE(Cache[Cache.FindPkg("pkgc")].Garbage);
+      EXPECT_FALSE(Cache[Cache.FindPkg("pkgd")].Garbage);
+
+      // a package going away is no root anymore
+      Transaction T(Cache, Transaction::Behavior::ROLLBACK);
+      EXPECT_TRUE(Cache.MarkDelete(Cache.FindPkg("pkga")));
+      ASSERT_TRUE(Cache.MarkAndSweep());
+      EXPECT_TRUE(Cache[Cache.FindPkg("pkgb")].Garbage);
+      EXPECT_TRUE(Cache[Cache.FindPkg("pkgc")].Garbage);
+      EXPECT_FALSE(Cache[Cache.FindPkg("pkgd")].Garbage);
+   }
+   _config->Clear("APT::AutoRemove::Threads");
+   removeDirectory(tempdir);
+}